@@ -0,0 +1,759 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "ext2.h"
+#include "blockio.h"
+#include "uring.h"
+#include "overlay.h"
+
+#define URING_ENTRIES 64
+
+struct cache_slot {
+	int block_num;       // -1 while the slot is empty
+	int pins;            // explicit pins from pin_block()
+	char in_use;         // handed out during the current operation
+	char referenced;     // CLOCK reference bit
+	char io_pending;     // an asynchronous read or write of data is in flight
+	unsigned char *data;
+};
+
+// An asynchronous request of the uring backend: one block read, or a
+// write of count adjacent blocks starting at block_num.
+struct io_request {
+	int is_write;
+	int block_num;
+	int count;
+	struct iovec iov[];
+};
+
+// A stripe of prefetch reads for one thread of the fallback pool.
+struct prefetch_stripe {
+	int *block_nums;
+	unsigned char **buffers;
+	int first;
+	int count;
+	int step;
+};
+
+static int backend = BLOCKIO_MMAP;
+static int io_fd = -1;
+static unsigned char *image;
+static size_t image_size;
+static int image_blocks;
+
+// block cache used by the pread and direct backends
+static struct cache_slot *slots;
+static int slot_count;
+static int slot_space;
+static int cache_capacity = 256;
+static int clock_hand;
+static int *block_slot;      // slot index of every image block, or -1
+static int unsynced_writes;  // written back since the last fdatasync
+static int io_threads = 4;   // prefetch threads when io_uring is unavailable
+
+// one bit per image block, set when the block has been modified since the last sync
+static unsigned char *dirty_blocks;
+static int dirty_count;
+static int durability = DURABILITY_NONE;
+static long flush_interval_ms = 100;
+static struct timespec last_flush;
+
+static long ms_since(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static unsigned char *alloc_block_buffer() {
+	void *buffer;
+	// O_DIRECT needs buffers aligned to the device's logical block size
+	if (posix_memalign(&buffer, 4096, EXT2_BLOCK_SIZE) != 0) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	return buffer;
+}
+
+static int block_is_dirty(int block_num) {
+	return (dirty_blocks[block_num / 8] >> (block_num % 8)) & 1;
+}
+
+static void clear_dirty(int block_num) {
+	if (block_is_dirty(block_num)) {
+		dirty_blocks[block_num / 8] &= ~(1 << (block_num % 8));
+		dirty_count -= 1;
+	}
+}
+
+static void read_block_into(int block_num, unsigned char *data) {
+	if (backend == BLOCKIO_OVERLAY) {
+		overlay_read_block(block_num, data);
+		return;
+	}
+	ssize_t got = pread(io_fd, data, EXT2_BLOCK_SIZE, (off_t) block_num * EXT2_BLOCK_SIZE);
+	if (got < 0) {
+		perror("pread");
+		exit(1);
+	}
+	if (got < EXT2_BLOCK_SIZE) {
+		memset(data + got, 0, EXT2_BLOCK_SIZE - got);
+	}
+}
+
+static void write_back_slot(struct cache_slot *slot) {
+	if (backend == BLOCKIO_OVERLAY) {
+		struct iovec iov = { slot->data, EXT2_BLOCK_SIZE };
+		overlay_write_blocks(slot->block_num, &iov, 1);
+	} else if (pwrite(io_fd, slot->data, EXT2_BLOCK_SIZE, (off_t) slot->block_num * EXT2_BLOCK_SIZE) != EXT2_BLOCK_SIZE) {
+		perror("pwrite");
+		exit(1);
+	}
+	clear_dirty(slot->block_num);
+	unsynced_writes = 1;
+}
+
+static void evict_slot(struct cache_slot *slot) {
+	if (slot->block_num < 0) {
+		return;
+	}
+	if (block_is_dirty(slot->block_num)) {
+		write_back_slot(slot);
+	}
+	block_slot[slot->block_num] = -1;
+	slot->block_num = -1;
+}
+
+// Reap one completed asynchronous request of the uring backend.
+static void reap_request() {
+	int result;
+	struct io_request *request = uring_wait(&result);
+	if (request == NULL) {
+		return;
+	}
+	if (result < 0) {
+		fprintf(stderr, "io_uring: block %d: %s\n", request->block_num, strerror(-result));
+		exit(1);
+	}
+	if (request->is_write) {
+		if (result != request->count * EXT2_BLOCK_SIZE) {
+			fprintf(stderr, "io_uring: short write at block %d\n", request->block_num);
+			exit(1);
+		}
+		int i;
+		for (i = 0; i < request->count; i++) {
+			slots[block_slot[request->block_num + i]].io_pending = 0;
+		}
+	} else {
+		struct cache_slot *slot = &slots[block_slot[request->block_num]];
+		if (result < EXT2_BLOCK_SIZE) {
+			memset(slot->data + result, 0, EXT2_BLOCK_SIZE - result);
+		}
+		slot->io_pending = 0;
+	}
+	free(request);
+}
+
+static void wait_for_slot(int idx) {
+	while (slots[idx].io_pending) {
+		reap_request();
+	}
+}
+
+// Keep the number of asynchronous requests within the ring.
+static void make_room_for_request() {
+	while (uring_in_flight() >= URING_ENTRIES) {
+		reap_request();
+	}
+}
+
+static int new_slot() {
+	if (slot_count == slot_space) {
+		slot_space = slot_space ? slot_space * 2 : cache_capacity;
+		slots = realloc(slots, slot_space * sizeof(struct cache_slot));
+	}
+	struct cache_slot *slot = &slots[slot_count];
+	memset(slot, 0, sizeof(*slot));
+	slot->block_num = -1;
+	slot->data = alloc_block_buffer();
+	return slot_count++;
+}
+
+// Find a slot for a new block, evicting with CLOCK once the cache is full.
+static int find_free_slot() {
+	if (slot_count < cache_capacity) {
+		return new_slot();
+	}
+	int step;
+	for (step = 0; step < 2 * slot_count; step++) {
+		int idx = clock_hand;
+		struct cache_slot *slot = &slots[idx];
+		clock_hand = (clock_hand + 1) % slot_count;
+		if (slot->pins > 0 || slot->in_use || slot->io_pending) {
+			continue;
+		}
+		if (slot->referenced) {
+			slot->referenced = 0;
+			continue;
+		}
+		evict_slot(slot);
+		return idx;
+	}
+	if (uring_in_flight() > 0) {
+		// slots are only busy with asynchronous I/O: wait for it instead of growing
+		reap_request();
+		return find_free_slot();
+	}
+	// every cached block is in use by the current operation
+	return new_slot();
+}
+
+/*
+    Set up the backend chosen by EXT2_IO for the image open on fd.
+    Returns 0 on success, -1 on failure.
+ */
+int blockio_open(char *image_path, int fd, size_t size) {
+	char *policy = getenv("EXT2_DURABILITY");
+	if (policy != NULL && strcmp(policy, "op") == 0) {
+		durability = DURABILITY_OP;
+	} else if (policy != NULL && strcmp(policy, "batch") == 0) {
+		durability = DURABILITY_BATCH;
+	}
+	char *interval = getenv("EXT2_FLUSH_MS");
+	if (interval != NULL && atol(interval) > 0) {
+		flush_interval_ms = atol(interval);
+	}
+	char *io = getenv("EXT2_IO");
+	if (io != NULL && strcmp(io, "pread") == 0) {
+		backend = BLOCKIO_PREAD;
+	} else if (io != NULL && strcmp(io, "direct") == 0) {
+		backend = BLOCKIO_DIRECT;
+	} else if (io != NULL && strcmp(io, "uring") == 0) {
+		backend = BLOCKIO_URING;
+	}
+	if (getenv("EXT2_OVERLAY") != NULL) {
+		backend = BLOCKIO_OVERLAY;
+	}
+	char *threads = getenv("EXT2_IO_THREADS");
+	if (threads != NULL && atoi(threads) > 0) {
+		io_threads = atoi(threads) < BLOCKIO_MAX_THREADS ? atoi(threads) : BLOCKIO_MAX_THREADS;
+	}
+	char *cache_blocks = getenv("EXT2_CACHE_BLOCKS");
+	if (cache_blocks != NULL && atoi(cache_blocks) > 0) {
+		cache_capacity = atoi(cache_blocks);
+	}
+
+	image_size = size;
+	image_blocks = size / EXT2_BLOCK_SIZE;
+	dirty_blocks = calloc(image_blocks / 8 + 1, 1);
+	dirty_count = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+
+	if (backend == BLOCKIO_MMAP) {
+		io_fd = fd;
+		image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (image == MAP_FAILED) {
+			image = NULL;
+			return -1;
+		}
+		return 0;
+	}
+
+	io_fd = fd;
+	if (backend == BLOCKIO_OVERLAY && overlay_open(getenv("EXT2_OVERLAY"), fd, image_blocks) < 0) {
+		return -1;
+	}
+	if (backend == BLOCKIO_DIRECT) {
+		int direct_fd = open(image_path, O_RDWR | O_DIRECT);
+		unsigned char *probe = alloc_block_buffer();
+		if (direct_fd < 0 || pread(direct_fd, probe, EXT2_BLOCK_SIZE, 0) != EXT2_BLOCK_SIZE) {
+			fprintf(stderr, "O_DIRECT not supported for %s, using pread\n", image_path);
+			if (direct_fd >= 0) {
+				close(direct_fd);
+			}
+			backend = BLOCKIO_PREAD;
+		} else {
+			io_fd = direct_fd;
+		}
+		free(probe);
+	}
+	if (backend == BLOCKIO_URING && uring_init(URING_ENTRIES) < 0) {
+		fprintf(stderr, "io_uring not available, prefetching with %d threads\n", io_threads);
+	}
+	block_slot = malloc(image_blocks * sizeof(int));
+	memset(block_slot, -1, image_blocks * sizeof(int));
+	return 0;
+}
+
+void blockio_close() {
+	if (dirty_blocks == NULL) {
+		return;
+	}
+	if (backend == BLOCKIO_MMAP) {
+		if (durability != DURABILITY_NONE) {
+			flush_dirty_blocks(1);
+		}
+		munmap(image, image_size);
+		image = NULL;
+	} else {
+		// cached modifications exist nowhere else, so they are always written
+		flush_dirty_blocks(durability != DURABILITY_NONE);
+		while (uring_in_flight() > 0) {
+			reap_request();
+		}
+		if (durability != DURABILITY_NONE && unsynced_writes) {
+			fdatasync(io_fd);
+		}
+		uring_close();
+		overlay_close();
+		int i;
+		for (i = 0; i < slot_count; i++) {
+			free(slots[i].data);
+		}
+		free(slots);
+		slots = NULL;
+		slot_count = slot_space = 0;
+		free(block_slot);
+		block_slot = NULL;
+		if (backend == BLOCKIO_DIRECT) {
+			close(io_fd);
+		}
+	}
+	free(dirty_blocks);
+	dirty_blocks = NULL;
+}
+
+int blockio_backend() {
+	return backend;
+}
+
+// Threads to use for parallel work on the image: EXT2_IO_THREADS, clamped
+// to BLOCKIO_MAX_THREADS.
+int blockio_io_threads() {
+	return io_threads;
+}
+
+/*
+    Return a pointer to the contents of block_num. For the cache backends the
+    block stays cached at least until the end of the current operation.
+ */
+unsigned char *get_block(int block_num) {
+	if (block_num < 0 || block_num >= image_blocks) {
+		return NULL;
+	}
+	if (backend == BLOCKIO_MMAP) {
+		return image + (size_t) block_num * EXT2_BLOCK_SIZE;
+	}
+	int idx = block_slot[block_num];
+	if (idx < 0) {
+		idx = find_free_slot();
+		read_block_into(block_num, slots[idx].data);
+		slots[idx].block_num = block_num;
+		block_slot[block_num] = idx;
+	}
+	wait_for_slot(idx);
+	slots[idx].referenced = 1;
+	slots[idx].in_use = 1;
+	return slots[idx].data;
+}
+
+/*
+    Thread-safe read of block_num for read-only tools walking the image from
+    several threads: a pointer into the mapping with mmap, else the block
+    read into buffer without going through the cache, whose slots only one
+    thread may manage. Dirty cached blocks must have been flushed before.
+ */
+const unsigned char *read_block_shared(int block_num, unsigned char *buffer) {
+	if (block_num < 0 || block_num >= image_blocks) {
+		return NULL;
+	}
+	if (backend == BLOCKIO_MMAP) {
+		return image + (size_t) block_num * EXT2_BLOCK_SIZE;
+	}
+	if (backend == BLOCKIO_DIRECT) {
+		// O_DIRECT reads need an aligned buffer: bounce through one per thread
+		static __thread unsigned char *aligned;
+		if (aligned == NULL) {
+			aligned = alloc_block_buffer();
+		}
+		read_block_into(block_num, aligned);
+		memcpy(buffer, aligned, EXT2_BLOCK_SIZE);
+		return buffer;
+	}
+	read_block_into(block_num, buffer);
+	return buffer;
+}
+
+// Keep block_num cached (and its pointer valid) until unpin_block().
+void pin_block(int block_num) {
+	if (backend == BLOCKIO_MMAP) {
+		return;
+	}
+	get_block(block_num);
+	slots[block_slot[block_num]].pins += 1;
+}
+
+void unpin_block(int block_num) {
+	if (backend == BLOCKIO_MMAP || block_slot[block_num] < 0) {
+		return;
+	}
+	slots[block_slot[block_num]].pins -= 1;
+}
+
+static void *prefetch_stripe_reads(void *arg) {
+	struct prefetch_stripe *stripe = arg;
+	int i;
+	for (i = stripe->first; i < stripe->count; i += stripe->step) {
+		off_t offset = (off_t) stripe->block_nums[i] * EXT2_BLOCK_SIZE;
+		ssize_t got = pread(io_fd, stripe->buffers[i], EXT2_BLOCK_SIZE, offset);
+		if (got < EXT2_BLOCK_SIZE) {
+			memset(stripe->buffers[i] + (got > 0 ? got : 0), 0, EXT2_BLOCK_SIZE - (got > 0 ? got : 0));
+		}
+	}
+	return NULL;
+}
+
+// Read the given blocks into their slots on a small pool of threads.
+static void prefetch_with_threads(int *block_nums, unsigned char **buffers, int count) {
+	int thread_count = io_threads < count ? io_threads : count;
+	pthread_t threads[thread_count];
+	struct prefetch_stripe stripes[thread_count];
+	int i;
+	for (i = 0; i < thread_count; i++) {
+		stripes[i].block_nums = block_nums;
+		stripes[i].buffers = buffers;
+		stripes[i].first = i;
+		stripes[i].count = count;
+		stripes[i].step = thread_count;
+		pthread_create(&threads[i], NULL, prefetch_stripe_reads, &stripes[i]);
+	}
+	for (i = 0; i < thread_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+/*
+    Start reading the given blocks so that walking them does not cost one
+    synchronous read per block. Blocks already cached and block number 0 are
+    skipped. Only the uring backend batches reads; the mmap backend passes the
+    hint on to the kernel.
+ */
+void prefetch_blocks(int *block_nums, int count) {
+	int i;
+	if (backend == BLOCKIO_MMAP) {
+		for (i = 0; i < count; i++) {
+			if (block_nums[i] > 0 && block_nums[i] < image_blocks) {
+				madvise(image + ((size_t) block_nums[i] * EXT2_BLOCK_SIZE) / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE),
+					EXT2_BLOCK_SIZE, MADV_WILLNEED);
+			}
+		}
+		return;
+	}
+	if (backend != BLOCKIO_URING) {
+		return;
+	}
+	// never let a prefetch push out more than half of the cache
+	int limit = cache_capacity / 2;
+	int missing[count];
+	unsigned char *buffers[count];
+	int missing_count = 0;
+	for (i = 0; i < count && missing_count < limit; i++) {
+		int block_num = block_nums[i];
+		if (block_num <= 0 || block_num >= image_blocks || block_slot[block_num] >= 0) {
+			continue;
+		}
+		int idx = find_free_slot();
+		slots[idx].block_num = block_num;
+		slots[idx].referenced = 1;
+		block_slot[block_num] = idx;
+		missing[missing_count] = block_num;
+		buffers[missing_count] = slots[idx].data;
+		missing_count += 1;
+		// keeps the slot from being reused before its read is done
+		slots[idx].io_pending = 1;
+		if (uring_available()) {
+			make_room_for_request();
+			struct io_request *request = malloc(sizeof(struct io_request));
+			request->is_write = 0;
+			request->block_num = block_num;
+			request->count = 1;
+			uring_queue_read(io_fd, slots[idx].data, EXT2_BLOCK_SIZE, (off_t) block_num * EXT2_BLOCK_SIZE, request);
+		}
+	}
+	if (missing_count == 0) {
+		return;
+	}
+	if (uring_available()) {
+		uring_submit();
+	} else {
+		prefetch_with_threads(missing, buffers, missing_count);
+		for (i = 0; i < missing_count; i++) {
+			slots[block_slot[missing[i]]].io_pending = 0;
+		}
+	}
+}
+
+void mark_block_dirty(int block_num) {
+	if (block_num < 0 || block_num >= image_blocks) {
+		return;
+	}
+	if (backend != BLOCKIO_MMAP) {
+		// a dirty block must be cached until it is written back
+		get_block(block_num);
+	}
+	if ((dirty_blocks[block_num / 8] & (1 << (block_num % 8))) == 0) {
+		dirty_blocks[block_num / 8] |= (1 << (block_num % 8));
+		dirty_count += 1;
+	}
+}
+
+// msync every dirty range of the mapping, merging ranges that share a page.
+static int flush_mapped_ranges(int wait) {
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	int flags = wait ? MS_SYNC : MS_ASYNC;
+	int ranges = 0;
+	size_t range_start = 0;
+	size_t range_end = 0;
+
+	int block_num = 0;
+	while (block_num < image_blocks) {
+		if (!block_is_dirty(block_num)) {
+			block_num += 1;
+			continue;
+		}
+		// extend over the whole run of dirty blocks
+		int run_end = block_num;
+		while (run_end < image_blocks && block_is_dirty(run_end)) {
+			run_end += 1;
+		}
+		size_t start = ((size_t) block_num * EXT2_BLOCK_SIZE) / page_size * page_size;
+		size_t end = ((size_t) run_end * EXT2_BLOCK_SIZE + page_size - 1) / page_size * page_size;
+		if (end > image_size) {
+			end = image_size;
+		}
+		if (ranges > 0 && start <= range_end) {
+			// touches the previous range once rounded to pages
+			range_end = end;
+		} else {
+			if (ranges > 0) {
+				msync(image + range_start, range_end - range_start, flags);
+			}
+			range_start = start;
+			range_end = end;
+			ranges += 1;
+		}
+		block_num = run_end;
+	}
+	msync(image + range_start, range_end - range_start, flags);
+
+	if (wait) {
+		memset(dirty_blocks, 0, image_blocks / 8 + 1);
+		dirty_count = 0;
+	}
+	return ranges;
+}
+
+// Queue every run of dirty cached blocks as one asynchronous write. With
+// wait set, all writes are reaped and the file synced before returning.
+static int flush_ranges_async(int wait) {
+	int ranges = 0;
+	int block_num = 0;
+	while (block_num < image_blocks) {
+		if (!block_is_dirty(block_num)) {
+			block_num += 1;
+			continue;
+		}
+		int run_start = block_num;
+		int count = 0;
+		while (block_num + count < image_blocks && block_is_dirty(block_num + count) && count < IOV_MAX) {
+			count += 1;
+		}
+		struct io_request *request = malloc(sizeof(struct io_request) + count * sizeof(struct iovec));
+		request->is_write = 1;
+		request->block_num = run_start;
+		request->count = count;
+		int i;
+		for (i = 0; i < count; i++) {
+			int idx = block_slot[run_start + i];
+			// an earlier write of the same block must land first
+			wait_for_slot(idx);
+			slots[idx].io_pending = 1;
+			request->iov[i].iov_base = slots[idx].data;
+			request->iov[i].iov_len = EXT2_BLOCK_SIZE;
+			clear_dirty(run_start + i);
+		}
+		make_room_for_request();
+		uring_queue_writev(io_fd, request->iov, count, (off_t) run_start * EXT2_BLOCK_SIZE, request);
+		unsynced_writes = 1;
+		ranges += 1;
+		block_num += count;
+	}
+	uring_submit();
+	if (wait) {
+		while (uring_in_flight() > 0) {
+			reap_request();
+		}
+		if (unsynced_writes) {
+			fdatasync(io_fd);
+			unsynced_writes = 0;
+		}
+	}
+	return ranges;
+}
+
+// pwritev every run of dirty cached blocks as one request.
+static int flush_cached_ranges(int wait) {
+	struct iovec iov[IOV_MAX];
+	int ranges = 0;
+	int block_num = 0;
+	while (block_num < image_blocks) {
+		if (!block_is_dirty(block_num)) {
+			block_num += 1;
+			continue;
+		}
+		int run_start = block_num;
+		int count = 0;
+		while (block_num < image_blocks && block_is_dirty(block_num) && count < IOV_MAX) {
+			iov[count].iov_base = slots[block_slot[block_num]].data;
+			iov[count].iov_len = EXT2_BLOCK_SIZE;
+			clear_dirty(block_num);
+			count += 1;
+			block_num += 1;
+		}
+		off_t offset = (off_t) run_start * EXT2_BLOCK_SIZE;
+		if (backend == BLOCKIO_OVERLAY) {
+			overlay_write_blocks(run_start, iov, count);
+			ranges += 1;
+			continue;
+		}
+		if (pwritev(io_fd, iov, count, offset) != (ssize_t) count * EXT2_BLOCK_SIZE) {
+			perror("pwritev");
+			exit(1);
+		}
+		if (!wait) {
+			sync_file_range(io_fd, offset, (off_t) count * EXT2_BLOCK_SIZE, SYNC_FILE_RANGE_WRITE);
+		}
+		unsynced_writes = 1;
+		ranges += 1;
+	}
+	if (backend == BLOCKIO_OVERLAY) {
+		overlay_sync(wait);
+	} else if (wait && unsynced_writes) {
+		fdatasync(io_fd);
+		unsynced_writes = 0;
+	}
+	return ranges;
+}
+
+/*
+    Write back the dirty blocks, coalescing adjacent blocks into one request
+    per range. With wait set the ranges are durable on return; otherwise
+    writeback is only started (for the mmap backend the blocks then stay
+    dirty until the next synchronous flush).
+    Returns the number of ranges flushed.
+ */
+int flush_dirty_blocks(int wait) {
+	if (dirty_blocks == NULL) {
+		return 0;
+	}
+	int ranges = 0;
+	if (backend == BLOCKIO_MMAP) {
+		if (dirty_count > 0) {
+			ranges = flush_mapped_ranges(wait);
+		}
+	} else if (uring_available()) {
+		ranges = flush_ranges_async(wait);
+	} else {
+		ranges = flush_cached_ranges(wait);
+	}
+	if (wait) {
+		clock_gettime(CLOCK_MONOTONIC, &last_flush);
+	}
+	return ranges;
+}
+
+/*
+    Queue writes of the blocks dirtied so far without waiting for them, so
+    that long writers overlap their I/O with producing more data. Only the
+    uring backend writes asynchronously; for the others this does nothing.
+ */
+void start_writeback() {
+	if (backend == BLOCKIO_URING && uring_available() && dirty_count > 0) {
+		flush_ranges_async(0);
+	}
+}
+
+/*
+    Release count blocks starting at start_block on the host by punching a
+    hole over them in the image file, so that the file only takes space for
+    blocks in use. The blocks must already be free and their freeing durable;
+    they read back as zeros afterwards. With an overlay the base image is
+    read-only and nothing is punched.
+    Returns 0 on success, -1 if the host file system cannot punch holes.
+ */
+int discard_blocks(int start_block, int count) {
+	if (backend == BLOCKIO_OVERLAY || start_block < 0 || count <= 0) {
+		return 0;
+	}
+	if (start_block + count > image_blocks) {
+		count = image_blocks - start_block;
+	}
+	int block_num;
+	for (block_num = start_block; block_num < start_block + count; block_num++) {
+		clear_dirty(block_num);
+		if (backend != BLOCKIO_MMAP && block_slot[block_num] >= 0) {
+			// keep a cached copy consistent with the hole
+			wait_for_slot(block_slot[block_num]);
+			memset(slots[block_slot[block_num]].data, 0, EXT2_BLOCK_SIZE);
+		}
+	}
+	return fallocate(io_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		(off_t) start_block * EXT2_BLOCK_SIZE, (off_t) count * EXT2_BLOCK_SIZE);
+}
+
+/*
+    Apply the durability policy at the end of an operation and let the cache
+    evict blocks used by it.
+ */
+void blockio_end_operation() {
+	if (durability == DURABILITY_OP) {
+		flush_dirty_blocks(1);
+	} else if (durability == DURABILITY_BATCH) {
+		flush_dirty_blocks(ms_since(&last_flush) >= flush_interval_ms);
+	}
+	release_cached_blocks();
+}
+
+/*
+    Let the cache evict the blocks handed out so far in the current
+    operation, except pinned ones, without ending the operation. Walks that
+    run as one long operation call this between steps so that the cache
+    stays within its size; pointers to blocks that are not pinned must not
+    be used afterwards.
+ */
+void release_cached_blocks() {
+	if (backend == BLOCKIO_MMAP) {
+		return;
+	}
+	int i;
+	for (i = 0; i < slot_count; i++) {
+		slots[i].in_use = 0;
+	}
+	// give back slots added while the cache was overcommitted
+	while (slot_count > cache_capacity && slots[slot_count - 1].pins == 0 && !slots[slot_count - 1].io_pending) {
+		evict_slot(&slots[slot_count - 1]);
+		free(slots[slot_count - 1].data);
+		slot_count -= 1;
+	}
+	if (clock_hand >= slot_count) {
+		clock_hand = 0;
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef EXT2_BLOCKIO_H
+#define EXT2_BLOCKIO_H
+
+#include <stddef.h>
+
+/*
+ * Block layer underneath the helpers. Every access to the image goes through
+ * get_block(), which returns a pointer to the block's contents.
+ *
+ * EXT2_IO selects the backend:
+ *   mmap   - the whole image is mapped shared (default)
+ *   pread  - blocks are read into a bounded cache with pread and written
+ *            back with pwrite; EXT2_CACHE_BLOCKS sets the cache size
+ *            (default 256 blocks)
+ *   direct - like pread, but the image is opened with O_DIRECT and the
+ *            cache uses aligned buffers so the host page cache is bypassed
+ *   uring  - like pread, but prefetched blocks are read with one io_uring
+ *            submission per batch and dirty ranges are written back
+ *            asynchronously; without io_uring, prefetches are spread over
+ *            EXT2_IO_THREADS (default 4, at most BLOCKIO_MAX_THREADS)
+ *            threads doing pread; the tools that work in parallel use as
+ *            many threads, see blockio_io_threads()
+ *   overlay - selected by EXT2_OVERLAY=<delta file>: the image is a read-only
+ *            base and every write goes to the delta (see overlay.h); uses
+ *            the same cache as pread
+ *
+ * A pointer returned by get_block() stays valid until the end of the current
+ * operation (blockio_end_operation), when cached blocks become evictable
+ * again. Blocks that must outlive an operation are pinned with pin_block().
+ * The cache grows past its size only while every block in it is in use;
+ * walks that run as one long operation call release_cached_blocks() between
+ * steps, keeping the pointers they still need pinned.
+ * prefetch_blocks() starts reading blocks that are about to be walked; a
+ * later get_block() of such a block waits for its read to finish.
+ *
+ * EXT2_DURABILITY selects when modified blocks are made durable:
+ *   none  - leave it to kernel writeback (default)
+ *   op    - synchronously after every operation
+ *   batch - at most every EXT2_FLUSH_MS milliseconds (default 100); between
+ *           flushes writeback of the dirty ranges is only started
+ * Modified blocks are always synced when the image is closed, unless the
+ * policy is none.
+ *
+ * read_block_shared() is the only call that may be made from several
+ * threads at once; it bypasses the cache, so dirty blocks are flushed first.
+ *
+ * discard_blocks() punches a hole in the image file over freed blocks so
+ * that host disk usage follows the blocks in use.
+ */
+
+#define BLOCKIO_MMAP   0
+#define BLOCKIO_PREAD  1
+#define BLOCKIO_DIRECT 2
+#define BLOCKIO_URING  3
+#define BLOCKIO_OVERLAY 4
+
+#define BLOCKIO_MAX_THREADS 64
+
+#define DURABILITY_NONE  0
+#define DURABILITY_OP    1
+#define DURABILITY_BATCH 2
+
+int blockio_open(char *image_path, int fd, size_t size);
+void blockio_close();
+int blockio_backend();
+int blockio_io_threads();
+unsigned char *get_block(int block_num);
+const unsigned char *read_block_shared(int block_num, unsigned char *buffer);
+void pin_block(int block_num);
+void unpin_block(int block_num);
+void prefetch_blocks(int *block_nums, int count);
+void mark_block_dirty(int block_num);
+int flush_dirty_blocks(int wait);
+void start_writeback();
+int discard_blocks(int start_block, int count);
+void blockio_end_operation();
+void release_cached_blocks();
+
+#endif
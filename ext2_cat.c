@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+#include "iov.h"
+
+static unsigned char zero_block[EXT2_BLOCK_SIZE];
+
+/*
+    Write length bytes of the file inode_num starting at byte offset to
+    fd. The range is mapped in one go, so only the indirect block it
+    reaches is read; blocks are queued as pointers into the block layer and
+    adjacent ones go out as a single write. Holes read as zeroes.
+    Returns 0, or -1 if the write fails.
+ */
+int cat_range(int inode_num, int offset, int length, int fd) {
+    static struct iov_writer writer;
+    iov_writer_init(&writer, fd);
+    if (length <= 0) {
+        return 0;
+    }
+    int first_block = offset / EXT2_BLOCK_SIZE;
+    int last_block = (offset + length - 1) / EXT2_BLOCK_SIZE;
+    int block_nums[MAX_FILE_BLOCKS];
+    int count = map_file_range(inode_num, first_block, last_block - first_block + 1, block_nums);
+    int end = offset + length;
+    int i;
+    for (i = 0 ; i < count ; i++) {
+        int block_start = (first_block + i) * EXT2_BLOCK_SIZE;
+        int from = offset > block_start ? offset - block_start : 0;
+        int to = end < block_start + EXT2_BLOCK_SIZE ? end - block_start : EXT2_BLOCK_SIZE;
+        unsigned char *data = block_nums[i] != 0 ? get_block(block_nums[i]) : zero_block;
+        if (iov_queue(&writer, data + from, to - from) != 0) {
+            return -1;
+        }
+    }
+    return iov_flush(&writer);
+}
+
+// Writes a file, or length bytes of it from offset, to stdout.
+int main (int argc, char **argv) {
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "Usage: %s <image file name> <path> (<offset> (<length>))\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+
+    if (verify_absolute_path_structure(argv[2]) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(argv[2]);
+    int inode_num = lookup_path(EXT2_ROOT_INO, argv[2]);
+    if (inode_num == -1) {
+        return ENOENT;
+    }
+    char type = find_filetype(get_inode_pointer(inode_num)->i_mode);
+    if (type == 'd') {
+        return EISDIR;
+    }
+    if (type != 'f') {
+        return EINVAL;
+    }
+
+    long long size = get_inode_pointer(inode_num)->i_size;
+    long long offset = argc > 3 ? atoll(argv[3]) : 0;
+    long long length = argc > 4 ? atoll(argv[4]) : size;
+    if (offset < 0 || length < 0) {
+        return EINVAL;
+    }
+    // a range past the end reads what the file has
+    if (offset > size) {
+        offset = size;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    if (cat_range(inode_num, offset, length, STDOUT_FILENO) != 0) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
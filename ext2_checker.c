@@ -47,6 +47,11 @@ int verify_blocks_form_inode(struct ext2_inode *test_inode){
 	int indirect_iterations = 0;
 	int error_count = 0;
 
+	// a fast symlink keeps its target, not block numbers, in i_block
+	if (inode_is_fast_symlink(test_inode)) {
+		return 0;
+	}
+
 	int iteration_counts = (test_inode->i_blocks)/2;
 	if (iteration_counts >= 13){
 		indirect_iterations = iteration_counts - 12;
@@ -64,7 +69,7 @@ int verify_blocks_form_inode(struct ext2_inode *test_inode){
 		error_count += verify_block_enabled_or_enable(test_inode->i_block[12]);
 		int j;
 		// Index 12 is the pointer to a indirect block
-		int *indirect_blocks = (int *)(disk + (test_inode->i_block[12] * EXT2_BLOCK_SIZE));
+		int *indirect_blocks = (int *) get_block(test_inode->i_block[12]);
 
 		for (j = 0 ; j < indirect_iterations ; j++){
 			error_count += verify_block_enabled_or_enable(indirect_blocks[j]);
@@ -85,6 +90,10 @@ int edit_or_recurse(int block_num){
 	int total_errors = 0;
 	struct ext2_dir_entry *curr_entry; 
 
+	// curr_entry points into this block across the recursion below
+	pin_block(block_num);
+	// batch the inode table reads for every entry in this block
+	prefetch_dir_entry_inodes(block_num);
 	while (offset < EXT2_BLOCK_SIZE) {
 		curr_entry = get_dir_entry_pointer(block_num, offset);
 		if (curr_entry->inode ==0) {
@@ -98,6 +107,7 @@ int edit_or_recurse(int block_num){
 		// Test and protentially fix for feature (b)
 		if (curr_entry->file_type != convert_file_type(curr_entry_inode->i_mode)){
 			// There exist need to fix; perform. 
+			dirty_metadata_block(block_num);
 			curr_entry->file_type = convert_file_type(curr_entry_inode->i_mode);
 			total_errors += 1;
 			printf("Fixed: Entry type vs inode mismatch: inode [%d]\n", curr_entry->inode);
@@ -113,6 +123,7 @@ int edit_or_recurse(int block_num){
 
 		// Continue testing: (d)
 		if (curr_entry_inode->i_dtime != 0) {
+			dirty_inode(curr_entry->inode);
 			curr_entry_inode->i_dtime = 0;
 			total_errors += 1;
 			printf("Fixed: valid inode marked for deletion: [%d]\n", curr_entry->inode);
@@ -134,10 +145,14 @@ int edit_or_recurse(int block_num){
 			// curr_entry_inode
 			if (!(curr_entry->name_len == 1 && strncmp(curr_entry->name, ".", 1) == 0) 
 				&& !(curr_entry->name_len == 2 && strncmp(curr_entry->name, "..", 2) == 0)) {
+				int inode_block = inode_table_block(curr_entry->inode);
+				pin_block(inode_block);
 				total_errors += traverse_and_verifiy_inodes(curr_entry_inode);
+				unpin_block(inode_block);
 			}
 		} 
 	}
+	unpin_block(block_num);
 
 	return total_errors;
 
@@ -146,17 +161,24 @@ int edit_or_recurse(int block_num){
 // Indirect recursive function that works with edit_or_recurse. Will 
 // verifiy feature b, c, d, e for the inode and it's children.
 // NOTE: because it visit childrens, ext2_inode must be a parent and DIR!!!
+// The block holding inode must be pinned: the blocks of the directories
+// visited before are released from the cache here.
 int traverse_and_verifiy_inodes(struct ext2_inode *inode) {
 	int i;
 	int indirect_iterations = 0;
 	int total_fixes = 0;
 
+	// the whole check is one operation: keep the cache to its size
+	release_cached_blocks();
+
 	int iteration_counts = (inode->i_blocks)/2;
 	if (iteration_counts >= 13) {
 		indirect_iterations = iteration_counts - 12;
 		iteration_counts = 12;
 	}
 
+	// submit reads for all blocks of the directory at once
+	prefetch_inode_blocks(inode);
 	for (i = 0; i < 12; i++) {
 		if (inode->i_block[i] != 0) {
 			total_fixes += edit_or_recurse(inode->i_block[i]);
@@ -166,7 +188,8 @@ int traverse_and_verifiy_inodes(struct ext2_inode *inode) {
 	if (indirect_iterations > 0) {
 		int j;
 		// Index 12 is the pointer to a indirect block
-		int *indirect_blocks = (int *)(disk + (inode->i_block[12] * EXT2_BLOCK_SIZE));
+		int *indirect_blocks = (int *) get_block(inode->i_block[12]);
+		pin_block(inode->i_block[12]);
 
 		for (j = 0; j < indirect_iterations ; j++){
 			// set all blocks found in indirect blocks into 0
@@ -174,6 +197,7 @@ int traverse_and_verifiy_inodes(struct ext2_inode *inode) {
 				total_fixes += edit_or_recurse(indirect_blocks[j]);
 			}
 		}
+		unpin_block(inode->i_block[12]);
 
 		// if code has entered this block; then it's nesseary to test if this 
 		// block happens to be enabled
@@ -190,7 +214,9 @@ int traverse_and_verifiy_inodes(struct ext2_inode *inode) {
 // be traversed together
 int step_b_c_d_e(){
 	struct ext2_inode *root_inode = get_inode_pointer(EXT2_ROOT_INO);
+	pin_block(inode_table_block(EXT2_ROOT_INO));
 	int edits = traverse_and_verifiy_inodes(root_inode);
+	unpin_block(inode_table_block(EXT2_ROOT_INO));
 	return edits;
 }
 
@@ -209,6 +235,7 @@ int step_a(){
 		}
 		
 		total_fixes += diff;
+		dirty_metadata_block(1);
 		sb->s_free_blocks_count = bitmap_free_blocks;
 		printf("Fixed: Superblock's free blocks counter was off by %d compared to the bitmap\n", diff);
 	}
@@ -218,6 +245,7 @@ int step_a(){
 			diff = diff * (-1);
 		}
 		total_fixes += diff;
+		dirty_metadata_block(2);
 		gd->bg_free_blocks_count = bitmap_free_blocks;
 		printf("Fixed: Group descriptor's free blocks counter was off by %d compared to the bitmap\n", diff);
 	}
@@ -227,6 +255,7 @@ int step_a(){
 			diff = diff * (-1);
 		}
 		total_fixes += diff;
+		dirty_metadata_block(1);
 		sb->s_free_inodes_count = bitmap_free_inodes ;
 		printf("Fixed: Superblock's free inodes counter was off by %d compared to the bitmap\n", diff);
 	}
@@ -236,6 +265,7 @@ int step_a(){
 			diff = diff * (-1);
 		}
 		total_fixes += diff;
+		dirty_metadata_block(2);
 		gd->bg_free_inodes_count = bitmap_free_inodes ;
 		printf("Fixed: Group descriptor's free inodes counter was off by %d compared to the bitmap\n", diff);
 	}
@@ -252,14 +282,7 @@ int main (int argc, char **argv) {
         exit(1);
     }
     // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
+    open_image(argv[1]);
 
     
 	total += step_a();
@@ -7,24 +7,542 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
 #include "ext2.h"
 #include "helper.h"
+#include "blockio.h"
+#include "hash.h"
+
+
+/*
+    Read up to size bytes of the host file at path into a new buffer stored
+    in data. Returns the number of bytes read, or -1 if the file cannot be
+    read.
+ */
+int read_host_file(char *path, int size, char **data) {
+    *data = malloc(size + 1);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, *data + got, size - got);
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    return got;
+}
+
+
+/*
+    Copy size bytes of data into the file inode_num starting at byte offset
+    of the file, mapping (and allocating) blocks through the shared
+    block-map walker. Bytes of a block that the copy only partly covers are
+    kept, except past the end of the data, which is zeroed.
+ */
+void write_file_data(int inode_num, char *data, int offset, int size) {
+    int end = offset + size;
+    int written = 0;
+    while (offset < end) {
+        int file_block = offset / EXT2_BLOCK_SIZE;
+        int block_offset = offset % EXT2_BLOCK_SIZE;
+        int length = EXT2_BLOCK_SIZE - block_offset;
+        if (length > end - offset) {
+            length = end - offset;
+        }
+        int data_block_num = map_file_block(inode_num, file_block, 1);
+        // copy the contents of the file into the data block in the disk
+        dirty_data_block(data_block_num);
+        char *data_block = (char *) get_block(data_block_num);
+        memcpy(data_block + block_offset, data, length);
+        if (offset + length == end) {
+            memset(data_block + block_offset + length, 0, EXT2_BLOCK_SIZE - block_offset - length);
+        }
+        data += length;
+        offset += length;
+        written += 1;
+        // keep writes of finished blocks in flight while copying the next ones
+        if (written % 32 == 0) {
+            start_writeback();
+        }
+    }
+}
+
+
+// ------------------- -r: copy a host directory tree -----------------------
+
+// An entry of the host tree, in the order in which it is created in the image.
+// The entries of a directory are adjacent, so their inodes and blocks are too.
+struct copy_node {
+    char *host_path;
+    char *name;          // basename, points into host_path
+    int parent;          // index of the parent directory, -1 for the top
+    char type;           // 'd', 'f' or 's'
+    int size;
+    int inode_num;
+    char *data;          // file contents or symlink target, read ahead
+    int status;          // 0 until read, 1 once read, -1 if it cannot be
+    dev_t host_dev;
+    ino_t host_ino;
+    int host_links;
+    int read_only;       // no write permission on the host
+    int link_to;         // earlier node of the same host inode, or -1
+    unsigned long long hash;  // of the contents, with -d
+};
+
+#define READ_AHEAD_NODES 64   /* entries read ahead of the writer at most */
+
+static struct copy_node *nodes;
+static int node_count;
+static int dedupe;           // -d: link identical read-only files
+static int next_to_read;
+static int next_to_write;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+static int add_node(char *host_path, int parent, int *space) {
+    struct stat st;
+    if (lstat(host_path, &st) != 0) {
+        free(host_path);
+        return -ENOENT;
+    }
+    char type;
+    if (S_ISDIR(st.st_mode)) {
+        type = 'd';
+    } else if (S_ISREG(st.st_mode)) {
+        type = 'f';
+    } else if (S_ISLNK(st.st_mode)) {
+        type = 's';
+    } else {
+        fprintf(stderr, "skipping %s: not a file, directory or symlink\n", host_path);
+        free(host_path);
+        return 0;
+    }
+    if (type == 'f' && (st.st_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE > MAX_FILE_BLOCKS) {
+        free(host_path);
+        return -EFBIG;
+    }
+    if (type == 's' && st.st_size >= EXT2_BLOCK_SIZE) {
+        free(host_path);
+        return -ENAMETOOLONG;
+    }
+    if (node_count == *space) {
+        *space = *space * 2 + 64;
+        nodes = realloc(nodes, *space * sizeof(struct copy_node));
+    }
+    struct copy_node *node = &nodes[node_count++];
+    char *slash = strrchr(host_path, '/');
+    node->host_path = host_path;
+    node->name = slash == NULL ? host_path : slash + 1;
+    node->parent = parent;
+    node->type = type;
+    node->size = st.st_size;
+    node->inode_num = 0;
+    node->data = NULL;
+    node->status = 0;
+    node->host_dev = st.st_dev;
+    node->host_ino = st.st_ino;
+    node->host_links = st.st_nlink;
+    node->read_only = (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) == 0;
+    node->link_to = -1;
+    if (strlen(node->name) > EXT2_NAME_LEN) {
+        return -ENAMETOOLONG;
+    }
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+    Walk the host tree at host_root breadth first into nodes, the entries of
+    each directory sorted by name. Nothing in the image is touched.
+    Returns 0 on success, or a negative errno.
+ */
+static int collect_host_tree(char *host_root) {
+    int space = 0;
+    int error = add_node(strdup(host_root), -1, &space);
+    int i;
+    for (i = 0 ; error == 0 && i < node_count ; i++) {
+        if (nodes[i].type != 'd') {
+            continue;
+        }
+        DIR *dir = opendir(nodes[i].host_path);
+        if (dir == NULL) {
+            return -errno;
+        }
+        char **names = NULL;
+        int name_count = 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            names = realloc(names, (name_count + 1) * sizeof(char *));
+            names[name_count++] = strdup(entry->d_name);
+        }
+        closedir(dir);
+        qsort(names, name_count, sizeof(char *), compare_names);
+        int j;
+        for (j = 0 ; j < name_count ; j++) {
+            if (error == 0) {
+                char *path = malloc(strlen(nodes[i].host_path) + strlen(names[j]) + 2);
+                sprintf(path, "%s/%s", nodes[i].host_path, names[j]);
+                error = add_node(path, i, &space);
+            }
+            free(names[j]);
+        }
+        free(names);
+    }
+    return error;
+}
+
+static int compare_host_inodes(const void *a, const void *b) {
+    struct copy_node *x = &nodes[*(int *) a];
+    struct copy_node *y = &nodes[*(int *) b];
+    if (x->host_dev != y->host_dev) {
+        return x->host_dev < y->host_dev ? -1 : 1;
+    }
+    if (x->host_ino != y->host_ino) {
+        return x->host_ino < y->host_ino ? -1 : 1;
+    }
+    return *(int *) a - *(int *) b;
+}
+
+/*
+    Find the files that are hard links to the same host inode, (st_dev,
+    st_ino), and point each one after the first in walk order at the first,
+    so that only the first is copied and the others become links to it.
+    Returns the number of nodes that became links.
+ */
+static int find_host_links() {
+    int *candidates = malloc(node_count * sizeof(int));
+    int count = 0;
+    int i;
+    for (i = 0 ; i < node_count ; i++) {
+        if (nodes[i].type == 'f' && nodes[i].host_links > 1) {
+            candidates[count++] = i;
+        }
+    }
+    qsort(candidates, count, sizeof(int), compare_host_inodes);
+    int links = 0;
+    int first = 0;
+    for (i = 1 ; i < count ; i++) {
+        struct copy_node *first_node = &nodes[candidates[first]];
+        struct copy_node *node = &nodes[candidates[i]];
+        if (node->host_dev == first_node->host_dev && node->host_ino == first_node->host_ino) {
+            node->link_to = candidates[first];
+            links += 1;
+        } else {
+            first = i;
+        }
+    }
+    free(candidates);
+    return links;
+}
+
+/*
+    Count the blocks the copy needs: file data with the indirect block,
+    long symlink targets, and the blocks of each new directory, filled the
+    way make_dir_entry_in_inode fills them.
+    Returns the count, or -1 if a directory would need more than 12 blocks.
+ */
+static int count_tree_blocks() {
+    int *dir_used = calloc(node_count, sizeof(int));
+    int *dir_blocks = calloc(node_count, sizeof(int));
+    int blocks = 0;
+    int i;
+    for (i = 0 ; i < node_count ; i++) {
+        if (nodes[i].link_to != -1) {
+            // a link takes only its directory entry
+        } else if (nodes[i].type == 'f') {
+            int file_blocks = (nodes[i].size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+            blocks += file_blocks + (file_blocks > 12);
+        } else if (nodes[i].type == 's') {
+            blocks += (nodes[i].size >= EXT2_FAST_SYMLINK_MAX);
+        } else {
+            // "." and ".."
+            dir_used[i] = compute_rec_len(1) + compute_rec_len(2);
+            dir_blocks[i] = 1;
+        }
+        int parent = nodes[i].parent;
+        if (parent == -1) {
+            continue;
+        }
+        int rec_len = compute_rec_len(strlen(nodes[i].name));
+        if (dir_used[parent] + rec_len > EXT2_BLOCK_SIZE) {
+            dir_blocks[parent] += 1;
+            dir_used[parent] = 0;
+        }
+        dir_used[parent] += rec_len;
+    }
+    for (i = 0 ; i < node_count && blocks != -1 ; i++) {
+        if (dir_blocks[i] > 12) {
+            blocks = -1;
+        } else {
+            blocks += dir_blocks[i];
+        }
+    }
+    free(dir_used);
+    free(dir_blocks);
+    return blocks;
+}
+
+/*
+    Reader thread: reads file contents and symlink targets in node order,
+    staying at most READ_AHEAD_NODES entries ahead of the writer.
+ */
+static void *read_ahead(void *arg) {
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (next_to_read < node_count && next_to_read >= next_to_write + READ_AHEAD_NODES) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        if (next_to_read >= node_count) {
+            break;
+        }
+        struct copy_node *node = &nodes[next_to_read++];
+        pthread_mutex_unlock(&pool_lock);
+
+        int got = 0;
+        if (node->link_to != -1) {
+            // nothing to read for a link
+        } else if (node->type == 'f') {
+            got = read_host_file(node->host_path, node->size, &node->data);
+            if (dedupe && got > 0) {
+                node->hash = hash_buffer(node->data, got, 0);
+            }
+        } else if (node->type == 's') {
+            node->data = malloc(node->size + 1);
+            got = readlink(node->host_path, node->data, node->size);
+            if (got >= 0) {
+                node->data[got] = '\0';
+            }
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        // the file may have shrunk since the walk
+        if (got >= 0) {
+            node->size = got;
+        }
+        node->status = got < 0 ? -1 : 1;
+        pthread_cond_broadcast(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/*
+    Returns 1 if the file inode_num holds exactly the size bytes of data.
+ */
+static int file_matches(int inode_num, char *data, int size) {
+    if (get_inode_pointer(inode_num)->i_size != size) {
+        return 0;
+    }
+    int offset;
+    for (offset = 0 ; offset < size ; offset += EXT2_BLOCK_SIZE) {
+        int length = size - offset < EXT2_BLOCK_SIZE ? size - offset : EXT2_BLOCK_SIZE;
+        int block_num = map_file_block(inode_num, offset / EXT2_BLOCK_SIZE, 0);
+        if (block_num <= 0 || memcmp(get_block(block_num), data + offset, length) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+    With -d, look node up among the read-only files copied before it by the
+    hash of its contents. Returns the inode of an earlier file with the same
+    contents, or -1 after recording node as the first of its contents.
+    table has table_size slots (a power of two) holding node index + 1.
+ */
+static int find_duplicate(int *table, int table_size, int node_index) {
+    struct copy_node *node = &nodes[node_index];
+    int slot = (node->hash ^ node->size) & (table_size - 1);
+    while (table[slot] != 0) {
+        struct copy_node *other = &nodes[table[slot] - 1];
+        // equal hashes are only trusted once the contents compare equal
+        if (other->hash == node->hash && other->size == node->size
+            && file_matches(other->inode_num, node->data, node->size)) {
+            return other->inode_num;
+        }
+        slot = (slot + 1) & (table_size - 1);
+    }
+    table[slot] = node_index + 1;
+    return -1;
+}
+
+/*
+    Copy the host directory host_root into the image as dir_name in the
+    directory parent_num. The tree is walked and checked first; then the
+    free inodes are picked in one pass, in walk order, so each directory's
+    entries get adjacent inodes. Each is only taken in the operation that
+    creates its entry, so an import cut short leaves no inode allocated
+    without an entry, even with the journal. Reader threads
+    (blockio_io_threads()) read the host files ahead while this thread, the
+    only one touching the image, creates the entries in the same order, one operation each. Files
+    are written one after the other, so a directory's files end up packed.
+    Host hard links stay hard links; with -d so do read-only files with the
+    same contents.
+    Returns 0 on success, or an errno.
+ */
+int copy_tree(char *host_root, int parent_num, char *dir_name) {
+    int error = collect_host_tree(host_root);
+    if (error != 0) {
+        return -error;
+    }
+    nodes[0].name = dir_name;
+    if (strlen(dir_name) > EXT2_NAME_LEN) {
+        return ENAMETOOLONG;
+    }
+    int links = find_host_links();
+    int inodes_needed = node_count - links;
+    int blocks_needed = count_tree_blocks();
+    if (blocks_needed == -1) {
+        return ENOSPC;
+    }
+    // the directory copied into holds at most 12 blocks of entries
+    if (first_available_i_block(parent_num, strlen(dir_name)) == -1) {
+        return ENOSPC;
+    }
+    blocks_needed += inode_needs_new_block_for_new_dir_entry(parent_num, strlen(dir_name));
+    if (!ensure_free_space(blocks_needed, inodes_needed)) {
+        return ENOMEM;
+    }
+    // nothing else allocates inodes meanwhile, so the ones picked stay free
+    int *inode_nums = malloc(inodes_needed * sizeof(int));
+    if (find_free_inodes(inodes_needed, inode_nums) != inodes_needed) {
+        return ENOMEM;
+    }
+    int i;
+    int next_inode = 0;
+    for (i = 0 ; i < node_count ; i++) {
+        if (nodes[i].link_to == -1) {
+            nodes[i].inode_num = inode_nums[next_inode++];
+        }
+    }
+    free(inode_nums);
+    int table_size = 1;
+    while (table_size < 2 * node_count) {
+        table_size *= 2;
+    }
+    int *dedupe_table = calloc(table_size, sizeof(int));
+
+    int thread_count = blockio_io_threads();
+    pthread_t threads[thread_count];
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_create(&threads[i], NULL, read_ahead, NULL);
+    }
+
+    int status = 0;
+    for (i = 0 ; i < node_count ; i++) {
+        struct copy_node *node = &nodes[i];
+        pthread_mutex_lock(&pool_lock);
+        next_to_write = i;
+        pthread_cond_broadcast(&pool_cond);
+        while (node->status == 0) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        int dir_num = node->parent == -1 ? parent_num : nodes[node->parent].inode_num;
+        int same_inode = -1;
+        int error = 0;
+        if (node->parent != -1 && nodes[node->parent].status == -1) {
+            // its directory could not be made: nothing below it is copied
+            node->status = -1;
+            free(node->data);
+            node->data = NULL;
+            continue;
+        }
+        if (dedupe && node->status == 1 && node->type == 'f' && node->link_to == -1
+            && node->read_only && node->size > 0) {
+            same_inode = find_duplicate(dedupe_table, table_size, i);
+        }
+        if (node->link_to != -1 && nodes[node->link_to].status == -1) {
+            // the file it is a link to could not be copied
+            status = EIO;
+        } else if (node->link_to != -1) {
+            error = make_dir_entry_in_inode(dir_num, node->name, nodes[node->link_to].inode_num, 'f');
+        } else if (same_inode != -1) {
+            // identical read-only contents: link to the copy already made
+            node->inode_num = same_inode;
+            error = make_dir_entry_in_inode(dir_num, node->name, same_inode, 'f');
+        } else if (node->status == -1) {
+            // the host file went away since the walk: its inode stays free
+            fprintf(stderr, "%s: cannot read\n", node->host_path);
+            status = EIO;
+        } else if (node->type == 'd') {
+            update_inode_bitmap(node->inode_num, 1);
+            error = make_directory(dir_num, node->name, node->inode_num);
+        } else if (node->type == 's') {
+            update_inode_bitmap(node->inode_num, 1);
+            error = make_symlink(dir_num, node->name, node->data, node->inode_num);
+        } else {
+            update_inode_bitmap(node->inode_num, 1);
+            struct ext2_inode *file_inode = make_inode(node->inode_num, 'f');
+            file_inode->i_size = node->size;
+            // the entry first, so a file that cannot be linked has no blocks yet
+            error = make_dir_entry_in_inode(dir_num, node->name, node->inode_num, 'f');
+            if (error == 0) {
+                write_file_data(node->inode_num, node->data, 0, node->size);
+            }
+        }
+        if (error != 0) {
+            fprintf(stderr, "%s: no room in the directory\n", node->host_path);
+            if (node->link_to == -1 && same_inode == -1) {
+                // nothing links to it: give the inode back, and leave out
+                // the nodes below it or linked to it
+                update_inode_bitmap(node->inode_num, 0);
+                node->status = -1;
+            }
+            status = error;
+        }
+        free(node->data);
+        node->data = NULL;
+        end_operation();
+    }
+
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (i = 0 ; i < node_count ; i++) {
+        free(nodes[i].host_path);
+    }
+    free(nodes);
+    free(dedupe_table);
+    return status;
+}
 
 
 int main (int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <image file name> <path to source file> <path to dest>\n", argv[0]);
+    // -f overwrites an existing file in place, -a appends to it,
+    // -r copies a host directory tree, -d does too and links read-only
+    // files with identical contents to a single copy
+    int f_flag = (argc == 5 && strcmp(argv[2], "-f") == 0);
+    int a_flag = (argc == 5 && strcmp(argv[2], "-a") == 0);
+    dedupe = (argc == 5 && strcmp(argv[2], "-d") == 0);
+    int r_flag = (argc == 5 && strcmp(argv[2], "-r") == 0) || dedupe;
+    if (argc != 4 + f_flag + a_flag + r_flag) {
+        fprintf(stderr, "Usage: %s <image file name> (-f|-a|-r|-d) <path to source> <path to dest>\n", argv[0]);
         exit(1);
     }
     // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
+    open_image(argv[1]);
+    argv += f_flag + a_flag + r_flag;
+    if (r_flag) {
+        remove_trailing_slashes(argv[2]);
     }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
 
     // ------------------- handle dest path -----------------------
     int dest_parent_num;
@@ -38,8 +556,24 @@ int main (int argc, char **argv) {
         return ENOENT;
     }
     // edge case: when the entire path is just the root
-    if (strlen(argv[2]) == 1 && argv[3][0] == '/') {
-        return EEXIST;
+    if (strlen(argv[3]) == 1 && argv[3][0] == '/') {
+        if (!r_flag) {
+            return EEXIST;
+        }
+        // a tree copied to the root keeps its own name
+        char *src_name = strrchr(argv[2], '/');
+        src_name = src_name == NULL ? argv[2] : src_name + 1;
+        if (find_token_in_dir(EXT2_ROOT_INO, src_name) != -1) {
+            return EEXIST;
+        }
+        struct stat src_stat;
+        if (stat(argv[2], &src_stat) != 0) {
+            return ENOENT;
+        }
+        if (!S_ISDIR(src_stat.st_mode)) {
+            return ENOTDIR;
+        }
+        return copy_tree(argv[2], EXT2_ROOT_INO, src_name);
     }
     // find the position of the string at which basename starts
     int basename_offset = get_basename_offset(argv[3]);
@@ -56,7 +590,9 @@ int main (int argc, char **argv) {
     }
 
     int dest_child_name_len = strlen(dest_child_name);
-    int src_child_offset = get_basename_offset(argv[2]);
+    // the source is a host path: its basename starts after the last slash
+    char *src_slash = strrchr(argv[2], '/');
+    int src_child_offset = src_slash == NULL ? 0 : src_slash - argv[2] + 1;
     int src_child_name_len = strlen(argv[2]) - src_child_offset;
     // allocate cp_filename to be able to store either child_name
     int max_path_len = dest_child_name_len;
@@ -74,104 +610,113 @@ int main (int argc, char **argv) {
                 use the dest_child_name as the name of the file copy. 
     */
     dest_child_num = find_token_in_dir(dest_parent_num, dest_child_name);
+    int target_num = -1;
     if (dest_child_num != -1) {
         struct ext2_inode *base_inode = get_inode_pointer(dest_child_num);
         if (find_filetype(base_inode->i_mode) == 'd') {
             // dest_child_num becomes the destination directory
             dest_parent_num = dest_child_num;
             // copied file takes src_file_name
-            strncpy(cp_filename, argv[2] + src_child_offset, src_child_name_len - src_child_offset);
-            cp_filename[src_child_name_len - src_child_offset] = '\0';
+            strncpy(cp_filename, argv[2] + src_child_offset, src_child_name_len);
+            cp_filename[src_child_name_len] = '\0';
+            target_num = find_token_in_dir(dest_parent_num, cp_filename);
         } else {
-            return EEXIST;
+            strncpy(cp_filename, dest_child_name, dest_child_name_len);
+            cp_filename[dest_child_name_len] = '\0';
+            target_num = dest_child_num;
         }
     } else {
         strncpy(cp_filename, dest_child_name, dest_child_name_len);
         cp_filename[dest_child_name_len] = '\0';
     }
+    // an existing file is only written with -f or -a
+    if (target_num != -1) {
+        if (!f_flag && !a_flag) {
+            return EEXIST;
+        }
+        if (find_filetype(get_inode_pointer(target_num)->i_mode) != 'f') {
+            return EISDIR;
+        }
+    }
 
     // ------------------- handle source path -----------------------
-    FILE *src_fp = fopen(argv[2], "r");
-    if (src_fp == NULL) {
+    struct stat src_stat;
+    if (stat(argv[2], &src_stat) != 0) {
+        return ENOENT;
+    }
+    if (r_flag) {
+        if (!S_ISDIR(src_stat.st_mode)) {
+            return ENOTDIR;
+        }
+        return copy_tree(argv[2], dest_parent_num, cp_filename);
+    }
+    if (S_ISDIR(src_stat.st_mode)) {
+        return EISDIR;
+    }
+    if ((src_stat.st_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE > MAX_FILE_BLOCKS) {
+        return EFBIG;
+    }
+    char *src_data;
+    int src_file_size = read_host_file(argv[2], src_stat.st_size, &src_data);
+    if (src_file_size < 0) {
         return ENOENT;
     }
-    // jump file to end to find the size of file
-    fseek(src_fp, 0, SEEK_END);
-    int src_file_size = ftell(src_fp);
-    
-    // get the dest inode
-    struct ext2_inode *dir_inode = get_inode_pointer(dest_parent_num);
-    // find the i_block to place the inode of the new file
-    int i_block_idx = first_available_i_block(dest_parent_num, strlen(cp_filename));
-    int num_of_blocks_for_dir = 0;
+
+    if (target_num != -1) {
+        // ------- write into the existing file in place ------------
+        struct ext2_inode *file_inode = get_inode_pointer(target_num);
+        int offset = a_flag ? file_inode->i_size : 0;
+        int new_size = offset + src_file_size;
+        int new_blocks = (new_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+        if (new_blocks > MAX_FILE_BLOCKS) {
+            return EFBIG;
+        }
+        // only the blocks the file does not have yet are allocated
+        if (!ensure_free_space(unmapped_blocks(target_num, new_blocks), 0)) {
+            return ENOMEM;
+        }
+        // overwriting a longer file gives back the blocks past the new end
+        release_file_blocks(target_num, new_blocks);
+        write_file_data(target_num, src_data, offset, src_file_size);
+        dirty_inode(target_num);
+        file_inode->i_size = new_size;
+        return 0;
+    }
 
     // calculate how many free blocks do we need to find for this file
-    int num_of_blocks = (int)(src_file_size / EXT2_BLOCK_SIZE);
-    if (src_file_size % EXT2_BLOCK_SIZE > 0) {
+    int num_of_blocks = (src_file_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    if (num_of_blocks > MAX_FILE_BLOCKS) {
+        return EFBIG;
+    }
+    // the single indirect block
+    if (num_of_blocks > 12) {
         num_of_blocks += 1;
     }
-    
-    // check if dest directory requires a new block to store dir_entry of the new file
-    if (dir_inode->i_block[i_block_idx] == 0) {
-        // one more block is needed to make a new block for dir_entry
-        num_of_blocks_for_dir += 1;
+    // the dest directory holds at most 12 blocks of entries
+    if (first_available_i_block(dest_parent_num, strlen(cp_filename)) == -1) {
+        return ENOSPC;
     }
+    // check if dest directory requires a new block to store dir_entry of the new file
+    int num_of_blocks_for_dir = inode_needs_new_block_for_new_dir_entry(dest_parent_num, strlen(cp_filename));
     // error check: not enough blocks
-    if (gd->bg_free_blocks_count < (num_of_blocks + num_of_blocks_for_dir) || gd->bg_free_inodes_count < 1) {
+    if (!ensure_free_space(num_of_blocks + num_of_blocks_for_dir, 1)) {
         return ENOMEM;
     }
 
-    // jump back to start of file for reading the data
-    fseek(src_fp, 0, SEEK_SET);
-
     // ------- put data into the blocks and set up file inode ------------
     // create the inode of a new file
     int free_inode_num = find_first_available_inode();
     struct ext2_inode *file_inode = make_inode(free_inode_num, 'f');
     file_inode->i_size = src_file_size;
-    int block_count = 0;
-    // array representing the single indirect block
-    int *sib;
-    int sib_idx = 0;
-    // put file data into blocks for the file's inode
-    while (block_count < num_of_blocks) {
-        int data_block_num;
-        // direct mapping to data block
-        if (block_count < 12) {
-            if (file_inode->i_block[block_count] == 0) {
-                file_inode->i_block[block_count] = find_first_available_block();
-                file_inode->i_blocks += 2;
-            }
-            data_block_num = file_inode->i_block[block_count];
-        } else if (block_count == 12) {
-            // single indirection mapping to data block
-            if (file_inode->i_block[12] == 0) {
-                file_inode->i_block[12] = find_first_available_block();
-                file_inode->i_blocks += 2;
-            }
-        }
-        if (block_count >= 12) {
-            // get block number from sib
-            sib = (int *) (disk + EXT2_BLOCK_SIZE * file_inode->i_block[12]);
-            // find the data_block
-            sib[sib_idx] = find_first_available_block();
-            file_inode->i_blocks += 2;
-            data_block_num = sib[sib_idx];
-            sib_idx += 1;
-        }
-        // read the contents of the file into the data block in the disk
-        char *data_block = (char *)(disk + (data_block_num * EXT2_BLOCK_SIZE));
-        fread(data_block, sizeof(char), EXT2_BLOCK_SIZE, src_fp);
-        block_count += 1;
-    }
+    write_file_data(free_inode_num, src_data, 0, src_file_size);
 
     // ----------------- put file inode into destination directory --------
-    // allocate block if no block has been assigned to this i_block
-    if (dir_inode->i_block[i_block_idx] == 0) {
-        dir_inode->i_block[i_block_idx] = find_first_available_block();
-    }
     // make a dir_entry for file_inode and place it in directory
-    make_dir_entry_in_inode(dest_parent_num, cp_filename, free_inode_num, 'f');
-
-    return 0;
+    int error = make_dir_entry_in_inode(dest_parent_num, cp_filename, free_inode_num, 'f');
+    if (error != 0) {
+        // not linked anywhere: give the file back
+        release_file_blocks(free_inode_num, 0);
+        update_inode_bitmap(free_inode_num, 0);
+    }
+    return error;
 }
\ No newline at end of file
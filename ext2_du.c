@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ext2.h"
+#include "helper.h"
+#include "blockio.h"
+
+/*
+    A directory of the subtree. Its total is the KiB in use by itself and
+    everything below it; pending counts the listing and the subdirectories
+    still to add to it, and whoever brings it to zero adds the total to the
+    parent's.
+ */
+struct du_dir {
+    struct du_dir *parent;
+    char *name;
+    int inode_num;
+    long long total;
+    int pending;
+    struct du_dir **children;
+    int child_count;
+};
+
+// one bit per inode: files with several links are counted at the first
+static unsigned char *visited;
+
+// directories waiting for a worker, the most recent on top
+static struct du_dir **stack;
+static int stack_count;
+static int stack_space;
+static int active;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dir_changed = PTHREAD_COND_INITIALIZER;
+
+// Mark inode_num seen; returns 1 if it already was.
+static int test_and_set_visited(int inode_num) {
+    unsigned char bit = 1 << (inode_num % 8);
+    return (__sync_fetch_and_or(&visited[inode_num / 8], bit) & bit) != 0;
+}
+
+// KiB in use by inode, counting its indirect block.
+static long long inode_kib(struct ext2_inode *inode) {
+    return inode->i_blocks / 2;
+}
+
+/*
+    One part of dir's total is in: the last one adds the total to the
+    parent's, which may complete it in turn.
+ */
+static void complete_part(struct du_dir *dir) {
+    while (dir != NULL && __sync_sub_and_fetch(&dir->pending, 1) == 0) {
+        if (dir->parent != NULL) {
+            __sync_fetch_and_add(&dir->parent->total, dir->total);
+        }
+        dir = dir->parent;
+    }
+}
+
+/*
+    Add the usage of dir's entries other than subdirectories to its total
+    and collect the subdirectories, which are queued for the workers.
+    Safe to run from any thread.
+ */
+static void scan_directory(struct du_dir *dir) {
+    struct dir_cursor cursor;
+    struct ext2_dir_entry *entry;
+    int child_space = 0;
+    open_dir_cursor(&cursor, dir->inode_num);
+    long long total = inode_kib(&cursor.dir);
+    while ((entry = next_dir_entry(&cursor)) != NULL) {
+        struct ext2_inode inode;
+        read_inode_shared(entry->inode, &inode);
+        if (find_filetype(inode.i_mode) == 'd') {
+            if (dir->child_count == child_space) {
+                child_space = child_space * 2 + 8;
+                dir->children = realloc(dir->children, child_space * sizeof(struct du_dir *));
+            }
+            struct du_dir *child = calloc(1, sizeof(struct du_dir));
+            child->parent = dir;
+            child->name = strndup(entry->name, entry->name_len);
+            child->inode_num = entry->inode;
+            child->pending = 1;
+            dir->children[dir->child_count++] = child;
+            continue;
+        }
+        if (inode.i_links_count > 1 && test_and_set_visited(entry->inode)) {
+            continue;
+        }
+        total += inode_kib(&inode);
+    }
+    __sync_fetch_and_add(&dir->total, total);
+    __sync_fetch_and_add(&dir->pending, dir->child_count);
+
+    pthread_mutex_lock(&dir_lock);
+    if (stack_count + dir->child_count > stack_space) {
+        stack_space = (stack_count + dir->child_count) * 2;
+        stack = realloc(stack, stack_space * sizeof(struct du_dir *));
+    }
+    int i;
+    for (i = dir->child_count - 1 ; i >= 0 ; i--) {
+        stack[stack_count++] = dir->children[i];
+    }
+    pthread_cond_broadcast(&dir_changed);
+    pthread_mutex_unlock(&dir_lock);
+    complete_part(dir);
+}
+
+// Worker: scan directories until none are left or being scanned.
+static void *scan_directories(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&dir_lock);
+    while (1) {
+        if (stack_count == 0 && active == 0) {
+            break;
+        }
+        if (stack_count == 0) {
+            pthread_cond_wait(&dir_changed, &dir_lock);
+            continue;
+        }
+        struct du_dir *dir = stack[--stack_count];
+        active += 1;
+        pthread_mutex_unlock(&dir_lock);
+        scan_directory(dir);
+        pthread_mutex_lock(&dir_lock);
+        active -= 1;
+    }
+    pthread_cond_broadcast(&dir_changed);
+    pthread_mutex_unlock(&dir_lock);
+    return NULL;
+}
+
+
+// ------------------- output -----------------------
+
+// Write the path of dir, below top_path, to stdout.
+static void print_path(struct du_dir *dir, char *top_path) {
+    if (dir->parent == NULL) {
+        fputs(top_path, stdout);
+        return;
+    }
+    print_path(dir->parent, top_path);
+    if (dir->parent->parent != NULL || strcmp(top_path, "/") != 0) {
+        fputc('/', stdout);
+    }
+    fputs(dir->name, stdout);
+}
+
+// Print every directory under dir, subdirectories before their parent.
+static void print_totals(struct du_dir *dir, char *top_path) {
+    int i;
+    for (i = 0 ; i < dir->child_count ; i++) {
+        print_totals(dir->children[i], top_path);
+    }
+    printf("%lld\t", dir->total);
+    print_path(dir, top_path);
+    fputc('\n', stdout);
+}
+
+static void collect_dirs(struct du_dir *dir, struct du_dir **dirs, int *count) {
+    int i;
+    dirs[(*count)++] = dir;
+    for (i = 0 ; i < dir->child_count ; i++) {
+        collect_dirs(dir->children[i], dirs, count);
+    }
+}
+
+static int compare_totals(const void *a, const void *b) {
+    long long first = (*(struct du_dir **) a)->total;
+    long long second = (*(struct du_dir **) b)->total;
+    return first < second ? 1 : first > second ? -1 : 0;
+}
+
+
+// Prints the KiB in use under each directory of the subtree at path, or
+// with -s only its total, or with -n the N largest directories. Files
+// with several links count once, in the first directory to meet them.
+int main (int argc, char **argv) {
+    char *image_path = NULL;
+    char *path = NULL;
+    int summary = 0;
+    int top_n = 0;
+    int i;
+    for (i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            summary = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            top_n = atoi(argv[++i]);
+        } else if (image_path == NULL) {
+            image_path = argv[i];
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (image_path == NULL || path == NULL) {
+        fprintf(stderr, "Usage: %s <image file name> (-s | -n <count>) <path>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(image_path);
+
+    if (verify_absolute_path_structure(path) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(path);
+    int top_num = lookup_path(EXT2_ROOT_INO, path);
+    if (top_num == -1) {
+        return ENOENT;
+    }
+    // the workers read the image below the block cache
+    sync_image();
+    struct ext2_inode top_inode;
+    read_inode_shared(top_num, &top_inode);
+    if (find_filetype(top_inode.i_mode) != 'd') {
+        printf("%lld\t%s\n", inode_kib(&top_inode), path);
+        return 0;
+    }
+
+    visited = calloc(sb->s_inodes_count / 8 + 1, 1);
+    struct du_dir *top = calloc(1, sizeof(struct du_dir));
+    top->inode_num = top_num;
+    top->pending = 1;
+    stack_space = 64;
+    stack = malloc(stack_space * sizeof(struct du_dir *));
+    stack[stack_count++] = top;
+    int thread_count = blockio_io_threads();
+    pthread_t threads[thread_count];
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_create(&threads[i], NULL, scan_directories, NULL);
+    }
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (summary) {
+        printf("%lld\t%s\n", top->total, path);
+    } else if (top_n > 0) {
+        struct du_dir **dirs = malloc(sb->s_inodes_count * sizeof(struct du_dir *));
+        int count = 0;
+        collect_dirs(top, dirs, &count);
+        qsort(dirs, count, sizeof(struct du_dir *), compare_totals);
+        for (i = 0 ; i < count && i < top_n ; i++) {
+            printf("%lld\t", dirs[i]->total);
+            print_path(dirs[i], path);
+            fputc('\n', stdout);
+        }
+    } else {
+        print_totals(top, path);
+    }
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ext2.h"
+#include "helper.h"
+#include "blockio.h"
+#include "trash.h"
+
+// A run of a file's blocks that are adjacent in the image.
+struct data_run {
+    long long file_offset;
+    long long image_offset;
+    int length;
+};
+
+// A file whose data is written by the workers.
+struct file_job {
+    char *host_path;
+    int inode_num;
+    int size;
+    int mode;
+    unsigned int mtime;
+    struct data_run *runs;
+    int run_count;
+};
+
+// A host entry finished once the data is in place: a hard link, or the
+// attributes of a directory (set last so a read-only one can be filled).
+struct late_entry {
+    char *host_path;
+    char *link_to;       // first path of the same inode, NULL for a directory
+    int mode;
+    unsigned int mtime;
+};
+
+static struct file_job *jobs;
+static int job_count;
+static int next_job;
+static int image_fd;
+static int through_block_layer;  // overlay: the image file lacks the delta
+static int failures;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+    Copy the run from the image to out_fd, inside the kernel with
+    copy_file_range where the file systems allow it, else with pread and
+    pwrite. With an overlay the blocks are read through the block layer.
+    Returns 0, or -1 on failure.
+ */
+static int copy_run(int out_fd, struct data_run *run) {
+    if (through_block_layer) {
+        int done;
+        for (done = 0 ; done < run->length ; done += EXT2_BLOCK_SIZE) {
+            int length = run->length - done < EXT2_BLOCK_SIZE ? run->length - done : EXT2_BLOCK_SIZE;
+            unsigned char *data = get_block((run->image_offset + done) / EXT2_BLOCK_SIZE);
+            if (pwrite(out_fd, data, length, run->file_offset + done) != length) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    loff_t in_offset = run->image_offset;
+    loff_t out_offset = run->file_offset;
+    int left = run->length;
+    while (left > 0) {
+        ssize_t copied = copy_file_range(image_fd, &in_offset, out_fd, &out_offset, left, 0);
+        if (copied <= 0) {
+            break;
+        }
+        left -= copied;
+    }
+    char buffer[64 * EXT2_BLOCK_SIZE];
+    while (left > 0) {
+        int chunk = left < (int) sizeof(buffer) ? left : (int) sizeof(buffer);
+        if (pread(image_fd, buffer, chunk, in_offset) != chunk
+            || pwrite(out_fd, buffer, chunk, out_offset) != chunk) {
+            return -1;
+        }
+        in_offset += chunk;
+        out_offset += chunk;
+        left -= chunk;
+    }
+    return 0;
+}
+
+/*
+    Create the host file of job and write its runs. Blocks that are not
+    mapped are never written, so they stay holes once the file is extended
+    to its size.
+    Returns 0, or -1 on failure.
+ */
+static int write_file_job(struct file_job *job) {
+    int out_fd = open(job->host_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        return -1;
+    }
+    int status = 0;
+    int i;
+    for (i = 0 ; i < job->run_count && status == 0 ; i++) {
+        status = copy_run(out_fd, &job->runs[i]);
+    }
+    if (status == 0 && ftruncate(out_fd, job->size) != 0) {
+        status = -1;
+    }
+    if (status == 0 && job->mode != 0) {
+        status = fchmod(out_fd, job->mode);
+    }
+    if (status == 0 && job->mtime != 0) {
+        struct timespec times[2] = {{job->mtime, 0}, {job->mtime, 0}};
+        status = futimens(out_fd, times);
+    }
+    close(out_fd);
+    return status;
+}
+
+// Worker: takes the next file until there are none left.
+static void *extract_files(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        int index = next_job++;
+        pthread_mutex_unlock(&job_lock);
+        if (index >= job_count) {
+            return NULL;
+        }
+        if (write_file_job(&jobs[index]) != 0) {
+            perror(jobs[index].host_path);
+            __sync_fetch_and_add(&failures, 1);
+        }
+    }
+}
+
+/*
+    Record the runs of the file inode_num in job: adjacent blocks of the
+    image become one run, holes none.
+ */
+static void map_job_runs(struct file_job *job) {
+    int block_count = (job->size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    int block_nums[MAX_FILE_BLOCKS];
+    block_count = map_file_range(job->inode_num, 0, block_count, block_nums);
+    job->runs = malloc(block_count * sizeof(struct data_run) + 1);
+    job->run_count = 0;
+    int i;
+    for (i = 0 ; i < block_count ; i++) {
+        if (block_nums[i] == 0) {
+            continue;
+        }
+        long long file_offset = (long long) i * EXT2_BLOCK_SIZE;
+        int length = job->size - file_offset < EXT2_BLOCK_SIZE ? job->size - file_offset : EXT2_BLOCK_SIZE;
+        struct data_run *last = job->run_count > 0 ? &job->runs[job->run_count - 1] : NULL;
+        if (last != NULL && last->file_offset + last->length == file_offset
+            && last->image_offset + last->length == (long long) block_nums[i] * EXT2_BLOCK_SIZE) {
+            last->length += length;
+            continue;
+        }
+        struct data_run *run = &job->runs[job->run_count++];
+        run->file_offset = file_offset;
+        run->image_offset = (long long) block_nums[i] * EXT2_BLOCK_SIZE;
+        run->length = length;
+    }
+}
+
+// Permission bits of an inode; the tools that keep none leave the default.
+static int inode_mode(struct ext2_inode *inode) {
+    return inode->i_mode & 07777;
+}
+
+struct pending_dir {
+    int inode_num;
+    char *host_path;
+};
+
+/*
+    Walk the subtree of the directory top_num, creating every directory on
+    the host as it is met and queueing the files, symlinks and hard links
+    below host_top. Returns 0, or the number of entries that failed.
+ */
+static int walk_subtree(int top_num, char *host_top, struct late_entry **late, int *late_count) {
+    int job_space = 0;
+    int late_space = 0;
+    char **first_paths = calloc(sb->s_inodes_count + 1, sizeof(char *));
+    struct pending_dir *stack = malloc(sizeof(struct pending_dir));
+    int stack_count = 1;
+    int stack_space = 1;
+    int errors = 0;
+    stack[0].inode_num = top_num;
+    stack[0].host_path = strdup(host_top);
+
+    while (stack_count > 0) {
+        struct pending_dir dir = stack[--stack_count];
+        struct ext2_inode *dir_inode = get_inode_pointer(dir.inode_num);
+        int i;
+        for (i = 0 ; i < 12 && dir_inode->i_block[i] != 0 ; i++) {
+            int block_offset = 0;
+            while (block_offset < EXT2_BLOCK_SIZE) {
+                struct ext2_dir_entry *entry = get_dir_entry_pointer(dir_inode->i_block[i], block_offset);
+                if (entry->rec_len == 0) {
+                    break;
+                }
+                block_offset += entry->rec_len;
+                if (entry->inode == 0
+                    || (entry->name_len == 1 && entry->name[0] == '.')
+                    || (entry->name_len == 2 && strncmp(entry->name, "..", 2) == 0)) {
+                    continue;
+                }
+                // the trash is not part of the root's contents
+                if (dir.inode_num == EXT2_ROOT_INO && entry->name_len == strlen(TRASH_DIR_NAME)
+                    && strncmp(entry->name, TRASH_DIR_NAME, entry->name_len) == 0) {
+                    continue;
+                }
+                char *path = malloc(strlen(dir.host_path) + entry->name_len + 2);
+                sprintf(path, "%s/%.*s", dir.host_path, entry->name_len, entry->name);
+                struct ext2_inode *inode = get_inode_pointer(entry->inode);
+                char type = find_filetype(inode->i_mode);
+
+                if (type != 'd' && inode->i_links_count > 1 && first_paths[entry->inode] != NULL) {
+                    if (*late_count == late_space) {
+                        late_space = late_space * 2 + 64;
+                        *late = realloc(*late, late_space * sizeof(struct late_entry));
+                    }
+                    (*late)[*late_count].host_path = path;
+                    (*late)[*late_count].link_to = first_paths[entry->inode];
+                    *late_count += 1;
+                    continue;
+                }
+                if (type != 'd') {
+                    first_paths[entry->inode] = path;
+                }
+                if (type == 'd') {
+                    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                        perror(path);
+                        errors += 1;
+                        free(path);
+                        continue;
+                    }
+                    if (*late_count == late_space) {
+                        late_space = late_space * 2 + 64;
+                        *late = realloc(*late, late_space * sizeof(struct late_entry));
+                    }
+                    (*late)[*late_count].host_path = path;
+                    (*late)[*late_count].link_to = NULL;
+                    (*late)[*late_count].mode = inode_mode(inode);
+                    (*late)[*late_count].mtime = inode->i_mtime;
+                    *late_count += 1;
+                    if (stack_count == stack_space) {
+                        stack_space *= 2;
+                        stack = realloc(stack, stack_space * sizeof(struct pending_dir));
+                    }
+                    stack[stack_count].inode_num = entry->inode;
+                    stack[stack_count].host_path = path;
+                    stack_count += 1;
+                } else if (type == 'l') {
+                    char target[EXT2_BLOCK_SIZE + 1];
+                    int length = inode->i_size < EXT2_BLOCK_SIZE ? inode->i_size : EXT2_BLOCK_SIZE;
+                    memcpy(target, inode_is_fast_symlink(inode) ? (void *) inode->i_block : (void *) get_block(inode->i_block[0]), length);
+                    target[length] = '\0';
+                    if (symlink(target, path) != 0) {
+                        perror(path);
+                        errors += 1;
+                    }
+                } else if (type == 'f') {
+                    if (job_count == job_space) {
+                        job_space = job_space * 2 + 64;
+                        jobs = realloc(jobs, job_space * sizeof(struct file_job));
+                    }
+                    struct file_job *job = &jobs[job_count++];
+                    job->host_path = path;
+                    job->inode_num = entry->inode;
+                    job->size = inode->i_size;
+                    job->mode = inode_mode(inode);
+                    job->mtime = inode->i_mtime;
+                    map_job_runs(job);
+                }
+            }
+        }
+        end_operation();
+    }
+    free(stack);
+    free(first_paths);
+    return errors;
+}
+
+// Copies the subtree at path in the image into a host directory, created if
+// missing; a file is copied into it under its own name.
+int main (int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <image file name> <path> <host dir>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+
+    if (verify_absolute_path_structure(argv[2]) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(argv[2]);
+    int top_num = lookup_path(EXT2_ROOT_INO, argv[2]);
+    if (top_num == -1) {
+        return ENOENT;
+    }
+    if (mkdir(argv[3], 0755) != 0 && errno != EEXIST) {
+        perror(argv[3]);
+        return ENOENT;
+    }
+
+    struct late_entry *late = NULL;
+    int late_count = 0;
+    int errors = 0;
+    struct ext2_inode *top = get_inode_pointer(top_num);
+    if (find_filetype(top->i_mode) == 'd') {
+        errors = walk_subtree(top_num, argv[3], &late, &late_count);
+    } else if (find_filetype(top->i_mode) == 'f') {
+        char *name = strrchr(argv[2], '/') + 1;
+        jobs = malloc(sizeof(struct file_job));
+        jobs[0].host_path = malloc(strlen(argv[3]) + strlen(name) + 2);
+        sprintf(jobs[0].host_path, "%s/%s", argv[3], name);
+        jobs[0].inode_num = top_num;
+        jobs[0].size = top->i_size;
+        jobs[0].mode = inode_mode(top);
+        jobs[0].mtime = top->i_mtime;
+        map_job_runs(&jobs[0]);
+        job_count = 1;
+    } else {
+        return EINVAL;
+    }
+
+    int i;
+    if (blockio_backend() == BLOCKIO_OVERLAY) {
+        // the block layer is not thread-safe: this thread copies every file
+        through_block_layer = 1;
+        for (i = 0 ; i < job_count ; i++) {
+            if (write_file_job(&jobs[i]) != 0) {
+                perror(jobs[i].host_path);
+                errors += 1;
+            }
+            end_operation();
+        }
+    } else {
+        // the workers read the image file itself: it must hold every block
+        sync_image();
+        image_fd = open(argv[1], O_RDONLY);
+        if (image_fd < 0) {
+            perror(argv[1]);
+            return ENOENT;
+        }
+        int thread_count = blockio_io_threads();
+        pthread_t threads[thread_count];
+        for (i = 0 ; i < thread_count ; i++) {
+            pthread_create(&threads[i], NULL, extract_files, NULL);
+        }
+        for (i = 0 ; i < thread_count ; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        close(image_fd);
+        errors += failures;
+    }
+
+    // hard links once their first path exists
+    for (i = 0 ; i < late_count ; i++) {
+        if (late[i].link_to != NULL && link(late[i].link_to, late[i].host_path) != 0) {
+            perror(late[i].host_path);
+            errors += 1;
+        }
+    }
+    // directory attributes last, deepest first, so that filling a directory
+    // does not change its time afterwards
+    for (i = late_count - 1 ; i >= 0 ; i--) {
+        struct late_entry *entry = &late[i];
+        if (entry->link_to != NULL) {
+            continue;
+        }
+        if (entry->mode != 0) {
+            chmod(entry->host_path, entry->mode);
+        }
+        if (entry->mtime != 0) {
+            struct timespec times[2] = {{entry->mtime, 0}, {entry->mtime, 0}};
+            utimensat(AT_FDCWD, entry->host_path, times, 0);
+        }
+    }
+    return errors > 0 ? EIO : 0;
+}
@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ext2.h"
+#include "helper.h"
+#include "blockio.h"
+
+// inode table blocks a worker takes at a time
+#define SCAN_CHUNK_BLOCKS 16
+
+// parents followed up from a directory before it counts as unreachable
+#define MAX_PATH_DEPTH 4096
+
+// A matching entry: its name in the directory dir_num.
+struct match {
+    int dir_num;
+    int inode_num;
+    char *name;
+    char *path;          // filled in once the matches are in
+};
+
+static char *pattern;
+static int pattern_is_glob;
+static char *literal;            // longest run of pattern without wildcards
+static int literal_length;
+static int type_filter;          // EXT2_FT_* the entry must have, or -1
+
+static unsigned char inode_bitmap[EXT2_BLOCK_SIZE];
+static int table_blocks;
+static int next_table_block;
+
+static struct match *matches;
+static int match_count;
+static int match_space;
+static pthread_mutex_t match_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ------------------- matching -----------------------
+
+/*
+    The ']' closing the set opened by the '[' at glob, or NULL if there is
+    none and the '[' stands for itself. A ']' first in the set is part of
+    it.
+ */
+static const char *set_end(const char *glob) {
+    const char *set = glob + 1;
+    if (*set == '!' || *set == '^') {
+        set += 1;
+    }
+    if (*set == '\0') {
+        return NULL;
+    }
+    return strchr(set + 1, ']');
+}
+
+/*
+    Match name (name_len bytes, not terminated) against the glob pattern:
+    '*' is any run of bytes, '?' any one byte and [...] a set, with ranges
+    and '!' or '^' to negate. A '*' is retried from the last one only, so
+    the match is linear in practice.
+ */
+static int glob_match(const char *glob, const char *name, int name_len) {
+    const char *star = NULL;
+    int star_at = 0;
+    int at = 0;
+    while (at < name_len || *glob != '\0') {
+        if (*glob == '*') {
+            star = ++glob;
+            star_at = at;
+            continue;
+        }
+        if (at < name_len && *glob != '\0') {
+            unsigned char c = name[at];
+            const char *next = glob + 1;
+            int matched;
+            if (*glob == '?') {
+                matched = 1;
+            } else if (*glob == '[' && set_end(glob) != NULL) {
+                const char *set = glob + 1;
+                int negate = *set == '!' || *set == '^';
+                next = set_end(glob) + 1;
+                set += negate;
+                matched = 0;
+                do {
+                    if (set[1] == '-' && set + 2 < next - 1) {
+                        matched |= c >= (unsigned char) set[0] && c <= (unsigned char) set[2];
+                        set += 3;
+                    } else {
+                        matched |= c == (unsigned char) *set;
+                        set += 1;
+                    }
+                } while (set < next - 1);
+                matched = matched != negate;
+            } else {
+                matched = (unsigned char) *glob == c;
+            }
+            if (matched) {
+                glob = next;
+                at += 1;
+                continue;
+            }
+        }
+        // no match here: let the last '*' take one more byte
+        if (star == NULL || star_at >= name_len) {
+            return 0;
+        }
+        glob = star;
+        at = ++star_at;
+    }
+    return 1;
+}
+
+/*
+    Find the longest run of the glob without wildcards: every name that
+    matches contains it, so memmem rules most names out before the glob
+    matcher runs.
+ */
+static void find_literal(char *glob) {
+    static char longest[EXT2_NAME_LEN + 1];
+    int i = 0;
+    while (glob[i] != '\0') {
+        if (glob[i] == '[' && set_end(glob + i) != NULL) {
+            i = set_end(glob + i) - glob + 1;
+            continue;
+        }
+        if (glob[i] == '*' || glob[i] == '?' || glob[i] == '[') {
+            i += 1;
+            continue;
+        }
+        int start = i;
+        while (glob[i] != '\0' && glob[i] != '*' && glob[i] != '?' && glob[i] != '[') {
+            i += 1;
+        }
+        if (i - start > literal_length && i - start <= EXT2_NAME_LEN) {
+            literal_length = i - start;
+            memcpy(longest, glob + start, literal_length);
+        }
+    }
+    literal = longest;
+}
+
+static int name_matches(const char *name, int name_len) {
+    if (literal_length > 0 && memmem(name, name_len, literal, literal_length) == NULL) {
+        return 0;
+    }
+    return !pattern_is_glob || glob_match(pattern, name, name_len);
+}
+
+
+// ------------------- scanning -----------------------
+
+static void add_match(int dir_num, struct ext2_dir_entry *entry) {
+    pthread_mutex_lock(&match_lock);
+    if (match_count == match_space) {
+        match_space = match_space * 2 + 64;
+        matches = realloc(matches, match_space * sizeof(struct match));
+    }
+    matches[match_count].dir_num = dir_num;
+    matches[match_count].inode_num = entry->inode;
+    matches[match_count].name = strndup(entry->name, entry->name_len);
+    matches[match_count].path = NULL;
+    match_count += 1;
+    pthread_mutex_unlock(&match_lock);
+}
+
+static int inode_in_use(int inode_num) {
+    return (inode_bitmap[(inode_num - 1) / 8] >> ((inode_num - 1) % 8)) & 1;
+}
+
+/*
+    Worker: take chunks of the inode table in turn and match the entries
+    of every directory in them, without following the tree.
+ */
+static void *scan_inode_table(void *arg) {
+    (void) arg;
+    int per_block = EXT2_BLOCK_SIZE / sizeof(struct ext2_inode);
+    while (1) {
+        int first = __sync_fetch_and_add(&next_table_block, SCAN_CHUNK_BLOCKS);
+        if (first >= table_blocks) {
+            break;
+        }
+        int last = first + SCAN_CHUNK_BLOCKS < table_blocks ? first + SCAN_CHUNK_BLOCKS : table_blocks;
+        int table_block;
+        for (table_block = first ; table_block < last ; table_block++) {
+            unsigned char buffer[EXT2_BLOCK_SIZE];
+            const unsigned char *block = read_block_shared(gd->bg_inode_table + table_block, buffer);
+            int i;
+            for (i = 0 ; i < per_block && block != NULL ; i++) {
+                int inode_num = table_block * per_block + i + 1;
+                struct ext2_inode *inode = (struct ext2_inode *) (block + i * sizeof(struct ext2_inode));
+                if (inode_num > (int) sb->s_inodes_count) {
+                    break;
+                }
+                // of the reserved inodes only the root is a directory of the tree
+                if ((inode_num < EXT2_GOOD_OLD_FIRST_INO && inode_num != EXT2_ROOT_INO)
+                    || !inode_in_use(inode_num) || find_filetype(inode->i_mode) != 'd'
+                    || inode->i_links_count == 0) {
+                    continue;
+                }
+                struct dir_cursor cursor;
+                struct ext2_dir_entry *entry;
+                open_dir_cursor(&cursor, inode_num);
+                while ((entry = next_dir_entry(&cursor)) != NULL) {
+                    if (type_filter >= 0 && entry->file_type != type_filter) {
+                        continue;
+                    }
+                    if (name_matches(entry->name, entry->name_len)) {
+                        add_match(inode_num, entry);
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+
+// ------------------- paths -----------------------
+
+/*
+    The path of directory dir_num, built on first use from its ".." entry
+    and the entry naming it there, and kept in dir_paths for the other
+    matches below it. A directory not reachable from the root is shown as
+    "<inode N>".
+ */
+static char *directory_path(int dir_num, char **dir_paths, int depth) {
+    if (dir_paths[dir_num] != NULL) {
+        return dir_paths[dir_num];
+    }
+    char *path = NULL;
+    int parent_num = dir_num == EXT2_ROOT_INO ? -1 : lookup_path(dir_num, "..");
+    if (dir_num == EXT2_ROOT_INO) {
+        path = strdup("");
+    } else if (parent_num > 0 && parent_num != dir_num && depth < MAX_PATH_DEPTH) {
+        struct dir_cursor cursor;
+        struct ext2_dir_entry *entry;
+        open_dir_cursor(&cursor, parent_num);
+        while ((entry = next_dir_entry(&cursor)) != NULL) {
+            if ((int) entry->inode == dir_num) {
+                char *parent_path = directory_path(parent_num, dir_paths, depth + 1);
+                path = malloc(strlen(parent_path) + entry->name_len + 2);
+                sprintf(path, "%s/%.*s", parent_path, entry->name_len, entry->name);
+                break;
+            }
+        }
+    }
+    if (path == NULL) {
+        path = malloc(32);
+        sprintf(path, "<inode %d>", dir_num);
+    }
+    dir_paths[dir_num] = path;
+    return path;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((struct match *) a)->path, ((struct match *) b)->path);
+}
+
+
+// Prints the path of every entry in the image whose name contains text,
+// or with wildcards matches it as a glob, optionally of one type only.
+int main (int argc, char **argv) {
+    char *image_path = NULL;
+    int i;
+    type_filter = -1;
+    for (i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            i += 1;
+            type_filter = strcmp(argv[i], "f") == 0 ? EXT2_FT_REG_FILE
+                          : strcmp(argv[i], "d") == 0 ? EXT2_FT_DIR
+                          : strcmp(argv[i], "l") == 0 ? EXT2_FT_SYMLINK : -2;
+        } else if (image_path == NULL) {
+            image_path = argv[i];
+        } else if (pattern == NULL) {
+            pattern = argv[i];
+        } else {
+            pattern = NULL;
+            break;
+        }
+    }
+    if (image_path == NULL || pattern == NULL || type_filter == -2) {
+        fprintf(stderr, "Usage: %s <image file name> (-t f|d|l) <name or glob>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(image_path);
+    // the workers read the image below the block cache
+    sync_image();
+
+    pattern_is_glob = strpbrk(pattern, "*?[") != NULL;
+    if (pattern_is_glob) {
+        find_literal(pattern);
+    } else {
+        literal = pattern;
+        literal_length = strlen(pattern);
+    }
+    memcpy(inode_bitmap, get_block(gd->bg_inode_bitmap), EXT2_BLOCK_SIZE);
+    table_blocks = (sb->s_inodes_count * sizeof(struct ext2_inode) + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+
+    int thread_count = blockio_io_threads();
+    pthread_t threads[thread_count];
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_create(&threads[i], NULL, scan_inode_table, NULL);
+    }
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // only the directories holding matches, and their parents, get paths
+    char **dir_paths = calloc(sb->s_inodes_count + 1, sizeof(char *));
+    for (i = 0 ; i < match_count ; i++) {
+        char *dir_path = directory_path(matches[i].dir_num, dir_paths, 0);
+        matches[i].path = malloc(strlen(dir_path) + strlen(matches[i].name) + 2);
+        sprintf(matches[i].path, "%s/%s", dir_path, matches[i].name);
+        end_operation();
+    }
+    qsort(matches, match_count, sizeof(struct match), compare_paths);
+    for (i = 0 ; i < match_count ; i++) {
+        printf("%s\n", matches[i].path);
+    }
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ext2.h"
+#include "helper.h"
+#include "blockio.h"
+#include "trash.h"
+#include "hash.h"
+
+/*
+    Files are hashed in chunks of this many blocks, each chunk by whichever
+    worker takes it. A file of one chunk gets the plain XXH64 (seed 0) of
+    its contents, as xxhsum prints it; a longer one gets the XXH64 of its
+    chunk digests, each as 8 bytes little-endian, in file order.
+ */
+#define HASH_CHUNK_BLOCKS 64
+
+struct hash_file {
+    char *path;
+    int size;
+    int *block_nums;     // 0 for a hole
+    int chunk_count;
+    unsigned long long *chunk_digests;
+    int same_as;         // earlier file of the same inode, or -1
+};
+
+// A chunk of a file for a worker to hash.
+struct hash_chunk {
+    int file;
+    int chunk;
+};
+
+static struct hash_file *files;
+static int file_count;
+static int file_space;
+static struct hash_chunk *chunks;
+static int chunk_count;
+static int next_chunk;
+
+// A directory still to walk.
+struct pending_dir {
+    char *path;
+    int inode_num;
+};
+
+static unsigned char zero_block[EXT2_BLOCK_SIZE];
+
+
+// ------------------- hashing -----------------------
+
+// Worker: hash chunks, straight from the image blocks, until none are left.
+static void *hash_chunks(void *arg) {
+    (void) arg;
+    unsigned char buffer[EXT2_BLOCK_SIZE];
+    while (1) {
+        int next = __sync_fetch_and_add(&next_chunk, 1);
+        if (next >= chunk_count) {
+            break;
+        }
+        struct hash_file *file = &files[chunks[next].file];
+        int first = chunks[next].chunk * HASH_CHUNK_BLOCKS;
+        int block_count = (file->size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+        int last = first + HASH_CHUNK_BLOCKS < block_count ? first + HASH_CHUNK_BLOCKS : block_count;
+        struct hash_state state;
+        hash_init(&state, 0);
+        int i;
+        for (i = first ; i < last ; i++) {
+            int length = file->size - i * EXT2_BLOCK_SIZE < EXT2_BLOCK_SIZE ? file->size - i * EXT2_BLOCK_SIZE : EXT2_BLOCK_SIZE;
+            const unsigned char *data = zero_block;
+            if (file->block_nums[i] != 0) {
+                data = read_block_shared(file->block_nums[i], buffer);
+            }
+            hash_update(&state, data != NULL ? data : zero_block, length);
+        }
+        file->chunk_digests[chunks[next].chunk] = hash_final(&state);
+    }
+    return NULL;
+}
+
+// The digest of file from its chunk digests, see HASH_CHUNK_BLOCKS.
+static unsigned long long file_digest(struct hash_file *file) {
+    if (file->chunk_count == 1) {
+        return file->chunk_digests[0];
+    }
+    unsigned char digests[file->chunk_count * 8];
+    int i;
+    int j;
+    for (i = 0 ; i < file->chunk_count ; i++) {
+        for (j = 0 ; j < 8 ; j++) {
+            digests[i * 8 + j] = file->chunk_digests[i] >> (8 * j);
+        }
+    }
+    return hash_buffer(digests, sizeof(digests), 0);
+}
+
+
+// ------------------- walking -----------------------
+
+/*
+    Add the file inode_num at path to the manifest and queue its chunks.
+    Another name of an inode already queued takes the digest of the first.
+ */
+static void add_file(char *path, int inode_num, int *first_files) {
+    if (file_count == file_space) {
+        file_space = file_space * 2 + 64;
+        files = realloc(files, file_space * sizeof(struct hash_file));
+    }
+    struct hash_file *file = &files[file_count];
+    memset(file, 0, sizeof(struct hash_file));
+    file->path = path;
+    file->same_as = first_files[inode_num];
+    if (file->same_as >= 0) {
+        file_count += 1;
+        return;
+    }
+    first_files[inode_num] = file_count;
+    file->size = get_inode_pointer(inode_num)->i_size;
+    int block_count = (file->size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    file->block_nums = malloc((block_count + 1) * sizeof(int));
+    block_count = map_file_range(inode_num, 0, block_count, file->block_nums);
+    file->size = block_count * EXT2_BLOCK_SIZE < file->size ? block_count * EXT2_BLOCK_SIZE : file->size;
+    // an empty file is a single empty chunk
+    file->chunk_count = block_count > 0 ? (block_count + HASH_CHUNK_BLOCKS - 1) / HASH_CHUNK_BLOCKS : 1;
+    file->chunk_digests = malloc(file->chunk_count * sizeof(unsigned long long));
+    chunks = realloc(chunks, (chunk_count + file->chunk_count) * sizeof(struct hash_chunk));
+    int i;
+    for (i = 0 ; i < file->chunk_count ; i++) {
+        chunks[chunk_count].file = file_count;
+        chunks[chunk_count].chunk = i;
+        chunk_count += 1;
+    }
+    file_count += 1;
+}
+
+/*
+    Add every regular file under the directory top_num, named below
+    top_path, in directory order. The trash is left out of the root.
+ */
+static void walk_subtree(int top_num, char *top_path, int *first_files) {
+    struct pending_dir *stack = malloc(sizeof(struct pending_dir));
+    int stack_count = 1;
+    int stack_space = 1;
+    stack[0].path = strdup(strcmp(top_path, "/") == 0 ? "" : top_path);
+    stack[0].inode_num = top_num;
+    while (stack_count > 0) {
+        struct pending_dir dir = stack[--stack_count];
+        struct dir_cursor cursor;
+        struct ext2_dir_entry *entry;
+        int first_subdir = stack_count;
+        open_dir_cursor(&cursor, dir.inode_num);
+        while ((entry = next_dir_entry(&cursor)) != NULL) {
+            if (dir.inode_num == EXT2_ROOT_INO && entry->name_len == strlen(TRASH_DIR_NAME)
+                && strncmp(entry->name, TRASH_DIR_NAME, entry->name_len) == 0) {
+                continue;
+            }
+            char type = find_filetype(get_inode_pointer(entry->inode)->i_mode);
+            if (type != 'f' && type != 'd') {
+                continue;
+            }
+            char *path = malloc(strlen(dir.path) + entry->name_len + 2);
+            sprintf(path, "%s/%.*s", dir.path, entry->name_len, entry->name);
+            if (type == 'f') {
+                add_file(path, entry->inode, first_files);
+                continue;
+            }
+            if (stack_count == stack_space) {
+                stack_space *= 2;
+                stack = realloc(stack, stack_space * sizeof(struct pending_dir));
+            }
+            stack[stack_count].path = path;
+            stack[stack_count].inode_num = entry->inode;
+            stack_count += 1;
+        }
+        // the first subdirectory on top
+        int last = stack_count - 1;
+        while (first_subdir < last) {
+            struct pending_dir swap = stack[first_subdir];
+            stack[first_subdir] = stack[last];
+            stack[last] = swap;
+            first_subdir += 1;
+            last -= 1;
+        }
+        free(dir.path);
+        end_operation();
+    }
+    free(stack);
+}
+
+
+// Prints an XXH64 manifest, "<digest>  <path>" per line, of the regular
+// files under path, or of the file at path.
+int main (int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <image file name> <path>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+
+    if (verify_absolute_path_structure(argv[2]) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(argv[2]);
+    int top_num = lookup_path(EXT2_ROOT_INO, argv[2]);
+    if (top_num == -1) {
+        return ENOENT;
+    }
+    // the workers read the image below the block cache
+    sync_image();
+
+    int *first_files = malloc((sb->s_inodes_count + 1) * sizeof(int));
+    int i;
+    for (i = 0 ; i <= (int) sb->s_inodes_count ; i++) {
+        first_files[i] = -1;
+    }
+    char type = find_filetype(get_inode_pointer(top_num)->i_mode);
+    if (type == 'd') {
+        walk_subtree(top_num, argv[2], first_files);
+    } else if (type == 'f') {
+        add_file(strdup(argv[2]), top_num, first_files);
+    } else {
+        return EINVAL;
+    }
+
+    int thread_count = blockio_io_threads();
+    pthread_t threads[thread_count];
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_create(&threads[i], NULL, hash_chunks, NULL);
+    }
+    for (i = 0 ; i < thread_count ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0 ; i < file_count ; i++) {
+        struct hash_file *file = files[i].same_as >= 0 ? &files[files[i].same_as] : &files[i];
+        printf("%016llx  %s\n", file_digest(file), files[i].path);
+    }
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
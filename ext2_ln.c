@@ -10,24 +10,21 @@
 #include "ext2.h"
 #include "helper.h"
 
-void do_symlink(int src_num, int dest_num, char *ln_filepath, char *ln_filename) {
-    int symlink_num = find_first_available_inode();
-    struct ext2_inode *symlink = make_inode(symlink_num, 's');
-    // allocate block and put it in symlink inode
-    int symlink_block_num = find_first_available_block();
-    symlink->i_block[0] = symlink_block_num;
-    symlink->i_blocks += 2;
-    symlink->i_size = strlen(ln_filepath);
-    // put data into symlink_block
-    char *symlink_block = (char *)(disk + EXT2_BLOCK_SIZE * symlink_block_num);
-    strncpy(symlink_block, ln_filepath, strlen(ln_filepath));
-    // make the dir_entry in dest_inode
-    // this helper updates the symlink inode i_link_count automatically
-    make_dir_entry_in_inode(dest_num, ln_filename, symlink_num, 's'); 
+int do_symlink(int src_num, int dest_num, char *ln_filepath, char *ln_filename) {
+    int inode_num = find_first_available_inode();
+    if (inode_num == -1) {
+        return ENOSPC;
+    }
+    int error = make_symlink(dest_num, ln_filename, ln_filepath, inode_num);
+    if (error != 0) {
+        // not linked anywhere: give the inode back
+        update_inode_bitmap(inode_num, 0);
+    }
+    return error;
 }
 
-void do_hardlink(int src_num, int dest_num, char *filepath, char *ln_filename) {
-    make_dir_entry_in_inode(dest_num, ln_filename, src_num, 'f');
+int do_hardlink(int src_num, int dest_num, char *filepath, char *ln_filename) {
+    return make_dir_entry_in_inode(dest_num, ln_filename, src_num, 'f');
 }
 
 int main (int argc, char **argv) {
@@ -36,14 +33,7 @@ int main (int argc, char **argv) {
         exit(1);
     }
     // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
+    open_image(argv[1]);
 
     int s_flag = 0;
     if (strlen(argv[2]) == 2 && strncmp(argv[2], "-s", 2) == 0) {
@@ -140,21 +130,23 @@ int main (int argc, char **argv) {
     int num_of_inodes;
     int num_of_blocks;
     // verify there is enough space to do this operation
-    if (s_flag == 0) {
+    if (s_flag == 1) {
+        // a symlink needs an inode, and a data block only for a long target
         num_of_inodes = 1;
-        num_of_blocks = 1 + inode_needs_new_block_for_new_dir_entry(dest_num, strlen(ln_filename));
+        num_of_blocks = (strlen(argv[2 + s_flag]) >= EXT2_FAST_SYMLINK_MAX)
+                        + inode_needs_new_block_for_new_dir_entry(dest_num, strlen(ln_filename));
     } else {
         num_of_blocks = inode_needs_new_block_for_new_dir_entry(dest_num, strlen(ln_filename));
         num_of_inodes = 0;
     }
-    if (gd->bg_free_blocks_count < num_of_blocks || gd->bg_free_inodes_count < num_of_inodes) {
+    if (!ensure_free_space(num_of_blocks, num_of_inodes)) {
         return ENOMEM;
     }
 
     if (s_flag == 0) {
-        do_hardlink(src_child_num, dest_num, argv[2 + s_flag], ln_filename);
+        return do_hardlink(src_child_num, dest_num, argv[2 + s_flag], ln_filename);
     } else {
-        do_symlink(src_child_num, dest_num, argv[2 + s_flag], ln_filename);
+        return do_symlink(src_child_num, dest_num, argv[2 + s_flag], ln_filename);
     }
 
 
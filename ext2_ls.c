@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ext2.h"
+#include "helper.h"
+#include "blockio.h"
+#include "trash.h"
+
+// listings done by the workers but not yet printed, before they wait
+#define MAX_BUFFERED_LISTINGS 256
+
+#define TASK_PENDING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+
+/*
+    A directory to list. With -R the tasks form a tree in directory order:
+    a task's children are its subdirectories, known once it is listed.
+ */
+struct list_task {
+    char *path;
+    int inode_num;
+    int state;
+    char *output;        // the listing, buffered until its turn to print
+    size_t output_size;
+    struct list_task **children;
+    int child_count;
+};
+
+static int json;
+static int recursive;
+
+// tasks waiting for a worker, the most recent on top
+static struct list_task **stack;
+static int stack_count;
+static int stack_space;
+static int active;       // tasks being listed, which may add more
+static int buffered;     // listings done and waiting for the printer
+static pthread_mutex_t task_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t task_changed = PTHREAD_COND_INITIALIZER;
+
+
+// ------------------- output -----------------------
+
+// Write name as a JSON string.
+static void output_json_string(FILE *out, const char *name, int length) {
+    int i;
+    fputc('"', out);
+    for (i = 0 ; i < length ; i++) {
+        unsigned char c = name[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/*
+    Write the line for the entry name of the directory dir_path: inode,
+    type, size in bytes and blocks in use, as text or as a JSON object.
+ */
+static void output_entry(FILE *out, char *dir_path, const char *name, int name_len,
+                         int inode_num, struct ext2_inode *inode) {
+    char type = find_filetype(inode->i_mode);
+    unsigned int blocks = inode->i_blocks / (EXT2_BLOCK_SIZE / 512);
+    if (!json) {
+        fprintf(out, "%8d %c %10u %6u %.*s\n", inode_num, type, inode->i_size, blocks, name_len, name);
+        return;
+    }
+    fputs("{\"dir\":", out);
+    output_json_string(out, dir_path, strlen(dir_path));
+    fputs(",\"name\":", out);
+    output_json_string(out, name, name_len);
+    fprintf(out, ",\"inode\":%d,\"type\":\"%c\",\"size\":%u,\"blocks\":%u}\n",
+            inode_num, type, inode->i_size, blocks);
+}
+
+
+// ------------------- tasks -----------------------
+
+static struct list_task *new_task(char *path, int inode_num) {
+    struct list_task *task = calloc(1, sizeof(struct list_task));
+    task->path = path;
+    task->inode_num = inode_num;
+    return task;
+}
+
+/*
+    Write the listing of task's directory to out, entry by entry as the
+    directory blocks are read. With -R each subdirectory becomes a child
+    task; the trash is left out of the root. Safe to run from any thread.
+ */
+static void list_directory(struct list_task *task, FILE *out) {
+    struct dir_cursor cursor;
+    struct ext2_dir_entry *entry;
+    int child_space = 0;
+    if (recursive && !json) {
+        fprintf(out, "%s:\n", task->path);
+    }
+    open_dir_cursor(&cursor, task->inode_num);
+    while ((entry = next_dir_entry(&cursor)) != NULL) {
+        if (task->inode_num == EXT2_ROOT_INO && entry->name_len == strlen(TRASH_DIR_NAME)
+            && strncmp(entry->name, TRASH_DIR_NAME, entry->name_len) == 0) {
+            continue;
+        }
+        struct ext2_inode inode;
+        read_inode_shared(entry->inode, &inode);
+        output_entry(out, task->path, entry->name, entry->name_len, entry->inode, &inode);
+        if (!recursive || find_filetype(inode.i_mode) != 'd') {
+            continue;
+        }
+        if (task->child_count == child_space) {
+            child_space = child_space * 2 + 8;
+            task->children = realloc(task->children, child_space * sizeof(struct list_task *));
+        }
+        int root = strcmp(task->path, "/") == 0;
+        char *path = malloc(strlen(task->path) + entry->name_len + 2);
+        sprintf(path, "%s%s%.*s", task->path, root ? "" : "/", entry->name_len, entry->name);
+        task->children[task->child_count++] = new_task(path, entry->inode);
+    }
+    if (recursive && !json) {
+        fputc('\n', out);
+    }
+}
+
+/*
+    Mark task done and hand its subdirectories to the workers, the first
+    on top so that they go depth first, in the order they are printed.
+    Called with task_lock held.
+ */
+static void finish_task(struct list_task *task) {
+    int i;
+    if (stack_count + task->child_count > stack_space) {
+        stack_space = (stack_count + task->child_count) * 2;
+        stack = realloc(stack, stack_space * sizeof(struct list_task *));
+    }
+    for (i = task->child_count - 1 ; i >= 0 ; i--) {
+        stack[stack_count++] = task->children[i];
+    }
+    task->state = TASK_DONE;
+    active -= 1;
+    pthread_cond_broadcast(&task_changed);
+}
+
+/*
+    Worker: take the task on top of the stack and buffer its listing. Stops
+    once no tasks are left or being listed.
+ */
+static void *list_tasks(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&task_lock);
+    while (1) {
+        if (stack_count == 0 && active == 0) {
+            break;
+        }
+        if (stack_count == 0 || buffered >= MAX_BUFFERED_LISTINGS) {
+            pthread_cond_wait(&task_changed, &task_lock);
+            continue;
+        }
+        struct list_task *task = stack[--stack_count];
+        task->state = TASK_RUNNING;
+        active += 1;
+        buffered += 1;
+        pthread_mutex_unlock(&task_lock);
+
+        FILE *out = open_memstream(&task->output, &task->output_size);
+        list_directory(task, out);
+        fclose(out);
+
+        pthread_mutex_lock(&task_lock);
+        finish_task(task);
+    }
+    pthread_cond_broadcast(&task_changed);
+    pthread_mutex_unlock(&task_lock);
+    return NULL;
+}
+
+/*
+    Print the listings of the tree under top in preorder, freeing each once
+    printed. A listing no worker has started yet is written straight to
+    stdout by this thread instead of waiting for one.
+ */
+static void print_tasks(struct list_task *top) {
+    struct list_task **order = malloc(sizeof(struct list_task *));
+    int order_count = 1;
+    int order_space = 1;
+    order[0] = top;
+    while (order_count > 0) {
+        struct list_task *task = order[--order_count];
+        pthread_mutex_lock(&task_lock);
+        while (task->state == TASK_RUNNING) {
+            pthread_cond_wait(&task_changed, &task_lock);
+        }
+        if (task->state == TASK_PENDING) {
+            // take it off the stack, near the top as the workers go depth first
+            int i = stack_count - 1;
+            while (stack[i] != task) {
+                i -= 1;
+            }
+            memmove(&stack[i], &stack[i + 1], (stack_count - i - 1) * sizeof(struct list_task *));
+            stack_count -= 1;
+            task->state = TASK_RUNNING;
+            active += 1;
+            pthread_mutex_unlock(&task_lock);
+            list_directory(task, stdout);
+            pthread_mutex_lock(&task_lock);
+            finish_task(task);
+        } else {
+            buffered -= 1;
+            pthread_cond_broadcast(&task_changed);
+            pthread_mutex_unlock(&task_lock);
+            fwrite(task->output, 1, task->output_size, stdout);
+            free(task->output);
+            pthread_mutex_lock(&task_lock);
+        }
+        pthread_mutex_unlock(&task_lock);
+
+        if (order_count + task->child_count > order_space) {
+            order_space = (order_count + task->child_count) * 2;
+            order = realloc(order, order_space * sizeof(struct list_task *));
+        }
+        int i;
+        for (i = task->child_count - 1 ; i >= 0 ; i--) {
+            order[order_count++] = task->children[i];
+        }
+        free(task->children);
+        free(task->path);
+        free(task);
+    }
+    free(order);
+}
+
+
+// Lists the directory at path, or the entry of a file, as text or with -j
+// as JSON lines. -R lists the subdirectories too, in parallel.
+int main (int argc, char **argv) {
+    char *image_path = NULL;
+    char *path = NULL;
+    int i;
+    for (i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "-R") == 0) {
+            recursive = 1;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            json = 1;
+        } else if (image_path == NULL) {
+            image_path = argv[i];
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (image_path == NULL || path == NULL) {
+        fprintf(stderr, "Usage: %s <image file name> (-R) (-j) <path>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(image_path);
+
+    if (verify_absolute_path_structure(path) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(path);
+    int top_num = lookup_path(EXT2_ROOT_INO, path);
+    if (top_num == -1) {
+        return ENOENT;
+    }
+    // the listing reads the image below the block cache
+    sync_image();
+
+    struct ext2_inode top;
+    read_inode_shared(top_num, &top);
+    if (find_filetype(top.i_mode) != 'd') {
+        char *name = strrchr(path, '/') + 1;
+        char dir_path[name - path + 1];
+        snprintf(dir_path, sizeof(dir_path), "%.*s", name - path > 1 ? (int) (name - path - 1) : 1, path);
+        output_entry(stdout, dir_path, name, strlen(name), top_num, &top);
+    } else if (!recursive) {
+        struct list_task task = { path, top_num };
+        list_directory(&task, stdout);
+    } else {
+        int thread_count = blockio_io_threads();
+        struct list_task *root = new_task(strdup(path), top_num);
+        stack_space = 64;
+        stack = malloc(stack_space * sizeof(struct list_task *));
+        stack[stack_count++] = root;
+        pthread_t threads[thread_count];
+        for (i = 0 ; i < thread_count ; i++) {
+            pthread_create(&threads[i], NULL, list_tasks, NULL);
+        }
+        print_tasks(root);
+        for (i = 0 ; i < thread_count ; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(stack);
+    }
+
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
@@ -12,50 +12,122 @@
 #include "helper.h"
 
 /*
-    Make directory in the inode specified by the given inode number.
- */ 
-void make_directory(int parent_inode_num, char *new_name, int new_inode_num) {
-    // create an inode for the new directory
-    make_inode(new_inode_num, 'd');
+    Create directory new_name in parent_inode_num from an inode and a block
+    that were already allocated: the block gets the "." and ".." entries
+    directly, so no bitmap is scanned.
+    Returns 0, or ENOSPC if the parent has no room for the entry.
+ */
+int make_directory_in_block(int parent_inode_num, char *new_name, int new_inode_num, int block_num) {
+    struct ext2_inode *dir = make_inode(new_inode_num, 'd');
+    dir->i_block[0] = block_num;
+    dir->i_blocks = 2;
+    dir->i_links_count = 1; // "."
 
-    // make "." dir_entry into new_inode
-    make_dir_entry_in_inode(new_inode_num, ".", new_inode_num, 'd');
-    // make ".." dir_entry into new_inode
-    make_dir_entry_in_inode(new_inode_num, "..", parent_inode_num, 'd');
-    
-    // find the block of the parent directory for insertion
-    struct ext2_inode *parent_inode = get_inode_pointer(parent_inode_num);
-    int i_block_idx = first_available_i_block(parent_inode_num, strlen(new_name));
+    dirty_metadata_block(block_num);
+    memset(get_block(block_num), 0, EXT2_BLOCK_SIZE);
+    struct ext2_dir_entry *dot = get_dir_entry_pointer(block_num, 0);
+    dot->inode = new_inode_num;
+    dot->name_len = 1;
+    dot->file_type = EXT2_FT_DIR;
+    memcpy(dot->name, ".", 1);
+    dot->rec_len = compute_rec_len(1);
+    struct ext2_dir_entry *dotdot = get_dir_entry_pointer(block_num, dot->rec_len);
+    dotdot->inode = parent_inode_num;
+    dotdot->name_len = 2;
+    dotdot->file_type = EXT2_FT_DIR;
+    memcpy(dotdot->name, "..", 2);
+    dotdot->rec_len = EXT2_BLOCK_SIZE - dot->rec_len;
+    dirty_inode(parent_inode_num);
+    get_inode_pointer(parent_inode_num)->i_links_count += 1;
 
-    // new parent i_block case: no block has been assigned to this i_block
-    if (parent_inode->i_block[i_block_idx] == 0) {
-        // find a second available block
-        int new_parent_block = find_first_available_block();
-        parent_inode->i_block[i_block_idx] = new_parent_block;
-    }
-    
-    // make the dir_entry of this new directory in the parent directory
-    make_dir_entry_in_inode(parent_inode_num, new_name, new_inode_num, 'd');
-    
-    // update number of used directories to include the new directory
-    gd->bg_used_dirs_count += 1;
+    return make_dir_entry_in_inode(parent_inode_num, new_name, new_inode_num, 'd');
 }
 
+/*
+    mkdir -p: walk path from the root once, then create every missing
+    component in a single pass. The inodes and blocks of the new directories
+    are allocated together up front, the blocks next to the deepest existing
+    directory, and the counters are updated once.
+ */
+int make_path(char *path) {
+    // split the path into its components
+    int components = 0;
+    char *names[strlen(path) / 2 + 1];
+    char *token = strtok(path, "/");
+    while (token != NULL) {
+        names[components++] = token;
+        token = strtok(NULL, "/");
+    }
+
+    // resolve the longest existing prefix
+    int parent_num = EXT2_ROOT_INO;
+    int existing = 0;
+    while (existing < components) {
+        if (strlen(names[existing]) > EXT2_NAME_LEN) {
+            return ENAMETOOLONG;
+        }
+        int child_num = find_token_in_dir(parent_num, names[existing]);
+        if (child_num == -1) {
+            break;
+        }
+        if (find_filetype(get_inode_pointer(child_num)->i_mode) != 'd') {
+            return ENOTDIR;
+        }
+        parent_num = child_num;
+        existing += 1;
+    }
+    int missing = components - existing;
+    if (missing == 0) {
+        return 0;
+    }
+    int i;
+    for (i = existing ; i < components ; i++) {
+        if (strlen(names[i]) > EXT2_NAME_LEN) {
+            return ENAMETOOLONG;
+        }
+    }
+
+    // the existing parent holds at most 12 blocks of entries
+    if (first_available_i_block(parent_num, strlen(names[existing])) == -1) {
+        return ENOSPC;
+    }
+    // reserve everything up front: one block per new directory, plus one if
+    // the existing parent needs a new block for the first entry
+    int blocks_needed = missing + inode_needs_new_block_for_new_dir_entry(parent_num, strlen(names[existing]));
+    if (!ensure_free_space(blocks_needed, missing)) {
+        return ENOMEM;
+    }
+    int inode_nums[missing];
+    int block_nums[missing];
+    allocate_inodes(missing, inode_nums);
+    allocate_blocks_near(get_inode_pointer(parent_num)->i_block[0], missing, block_nums);
+
+    int error = 0;
+    for (i = 0 ; i < missing && error == 0 ; i++) {
+        error = make_directory_in_block(parent_num, names[existing + i], inode_nums[i], block_nums[i]);
+        parent_num = inode_nums[i];
+    }
+    // update number of used directories to include the new directories
+    dirty_metadata_block(2);
+    gd->bg_used_dirs_count += missing;
+    return error;
+}
 
 int main (int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <image file name> <path>\n", argv[0]);
+    int p_flag = (argc == 4 && strcmp(argv[2], "-p") == 0);
+    if (argc != 3 + p_flag) {
+        fprintf(stderr, "Usage: %s <image file name> (-p) <path>\n", argv[0]);
         exit(1);
     }
     // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
+    open_image(argv[1]);
+
+    if (p_flag) {
+        if (verify_absolute_path_structure(argv[3]) == 0) {
+            return ENOENT;
+        }
+        return make_path(argv[3]);
     }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
 
     int parent_num;
     char child_name[strlen(argv[2]) + 1];
@@ -94,10 +166,14 @@ int main (int argc, char **argv) {
         return EEXIST;
     }
     
+    // the parent holds at most 12 blocks of entries
+    if (first_available_i_block(parent_num, strlen(child_name)) == -1) {
+        return ENOSPC;
+    }
     // ensure that there are enough free blocks and inodes to complete the operation
     int blocks_needed = 1 + inode_needs_new_block_for_new_dir_entry(parent_num, strlen(child_name));
     int inodes_needed = 1;
-    if (gd->bg_free_inodes_count < inodes_needed || gd->bg_free_blocks_count < blocks_needed) {
+    if (!ensure_free_space(blocks_needed, inodes_needed)) {
         return ENOMEM;
     }
 
@@ -105,6 +181,9 @@ int main (int argc, char **argv) {
     int free_inode = find_first_available_inode();
 
     // perform mkdir
-    make_directory(parent_num, child_name, free_inode);
-    return 0;    
+    int error = make_directory(parent_num, child_name, free_inode);
+    if (error != 0) {
+        update_inode_bitmap(free_inode, 0);
+    }
+    return error;
 }
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+
+/*
+    Split path into the inode number of its parent directory (returned) and
+    its basename (stored in name). Returns a negative errno on failure.
+ */
+int resolve_path(char *path, char *name) {
+    // remove trailing slashes from path
+    remove_trailing_slashes(path);
+    // verify that the path starts with '/' indicating absolute path
+    if (verify_absolute_path_structure(path) == 0) {
+        return -ENOENT;
+    }
+    // the root itself cannot be moved or replaced
+    if (strlen(path) == 1 && path[0] == '/') {
+        return -EBUSY;
+    }
+    // find the position of the string at which basename starts
+    int basename_offset = get_basename_offset(path);
+    if (basename_offset <= 0) {
+        return -ENOENT;
+    }
+    // construct the basename string
+    strncpy(name, path + basename_offset, strlen(path) - basename_offset);
+    name[strlen(path) - basename_offset] = '\0';
+    // "." and ".." belong to their directory and are never moved or replaced
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -EINVAL;
+    }
+    // find the inode number of the parent directory
+    int parent_num = get_parent_inode_num_from_path(path, basename_offset - 1);
+    if (parent_num == -1 || find_filetype(get_inode_pointer(parent_num)->i_mode) != 'd') {
+        return -ENOENT;
+    }
+    return parent_num;
+}
+
+/*
+    Check whether directory dir_num is ancestor_num or lies below it, by
+    following ".." entries up to the root.
+ */
+int is_within(int dir_num, int ancestor_num) {
+    while (dir_num != EXT2_ROOT_INO) {
+        if (dir_num == ancestor_num) {
+            return 1;
+        }
+        dir_num = find_token_in_dir(dir_num, "..");
+        if (dir_num == -1) {
+            return 0;
+        }
+    }
+    return ancestor_num == EXT2_ROOT_INO;
+}
+
+// Moves or renames a file, symlink or directory inside the image by
+// relinking its directory entry; no data block is read or written.
+int main (int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <image file name> <source path> <dest path>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+
+    // ------------------- handle source path -----------------------
+    char src_name[strlen(argv[2]) + 1];
+    int src_parent_num = resolve_path(argv[2], src_name);
+    if (src_parent_num < 0) {
+        return -src_parent_num;
+    }
+    int src_num = find_token_in_dir(src_parent_num, src_name);
+    if (src_num == -1) {
+        return ENOENT;
+    }
+    char type = find_filetype(get_inode_pointer(src_num)->i_mode);
+
+    // ------------------- handle dest path -----------------------
+    int dest_name_max = strlen(argv[3]) > strlen(src_name) ? strlen(argv[3]) : strlen(src_name);
+    char dest_name[dest_name_max + 1];
+    int dest_parent_num;
+    int dest_num;
+    remove_trailing_slashes(argv[3]);
+    if (strcmp(argv[3], "/") == 0) {
+        // the root is the directory to move into
+        dest_parent_num = EXT2_ROOT_INO;
+        dest_num = EXT2_ROOT_INO;
+    } else {
+        dest_parent_num = resolve_path(argv[3], dest_name);
+        if (dest_parent_num < 0) {
+            return -dest_parent_num;
+        }
+        dest_num = find_token_in_dir(dest_parent_num, dest_name);
+    }
+    if (dest_num == src_num) {
+        return 0;
+    }
+    if (dest_num != -1) {
+        if (find_filetype(get_inode_pointer(dest_num)->i_mode) != 'd') {
+            return EEXIST;
+        }
+        // moving into an existing directory keeps the source name
+        dest_parent_num = dest_num;
+        strcpy(dest_name, src_name);
+        if (find_token_in_dir(dest_parent_num, dest_name) != -1) {
+            return dest_parent_num == src_parent_num ? 0 : EEXIST;
+        }
+    }
+    // a directory cannot be moved inside itself
+    if (type == 'd' && is_within(dest_parent_num, src_num)) {
+        return EINVAL;
+    }
+    // the destination holds at most 12 blocks of entries
+    if (first_available_i_block(dest_parent_num, strlen(dest_name)) == -1) {
+        return ENOSPC;
+    }
+    if (!ensure_free_space(inode_needs_new_block_for_new_dir_entry(dest_parent_num, strlen(dest_name)), 0)) {
+        return ENOMEM;
+    }
+
+    // link the new name first, so the inode is never left without one
+    int error = make_dir_entry_in_inode(dest_parent_num, dest_name, src_num, type == 'l' ? 's' : type);
+    if (error != 0) {
+        return error;
+    }
+    remove_victim_at_inode(src_parent_num, src_name);
+    if (type == 'd' && dest_parent_num != src_parent_num) {
+        reparent_directory(src_num, src_parent_num, dest_parent_num);
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+#include "overlay.h"
+
+// Merges a delta file created by running the tools with EXT2_OVERLAY=<delta>
+// back into its base image, leaving an empty delta behind.
+int main (int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <image file name> <delta file>\n", argv[0]);
+        exit(1);
+    }
+    if (access(argv[2], F_OK) != 0) {
+        return ENOENT;
+    }
+
+    // open the overlay once so that an interrupted transaction in the delta
+    // is rolled back before anything is merged
+    setenv("EXT2_OVERLAY", argv[2], 1);
+    open_image(argv[1]);
+    close_image();
+
+    int base_fd = open(argv[1], O_RDWR);
+    if (base_fd < 0) {
+        perror("open");
+        exit(1);
+    }
+    struct stat base_stat;
+    fstat(base_fd, &base_stat);
+    if (overlay_open(argv[2], base_fd, base_stat.st_size / EXT2_BLOCK_SIZE) < 0) {
+        return EINVAL;
+    }
+    int merged = overlay_commit(base_fd);
+    overlay_close();
+    close(base_fd);
+    if (merged < 0) {
+        perror("commit");
+        return EIO;
+    }
+    printf("%d block(s) merged into %s\n", merged, argv[1]);
+    return 0;
+}
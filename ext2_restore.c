@@ -11,173 +11,486 @@
 #include <errno.h>
 #include "ext2.h"
 #include "helper.h"
+#include "trash.h"
 
-// This is the function dedicated for dir entires that are for sure to be restored
-void restore_dir_entry(	struct ext2_dir_entry *entry_to_be_restored, 
-						struct ext2_inode *parent_inode,
-						int i_block_index
-						) {
+// A removed directory entry that is still readable in the rec_len slack of
+// a live entry of its directory
+struct deleted_entry {
+	char name[EXT2_NAME_LEN + 1];
+	int inode;
+	unsigned char file_type;
+	unsigned int dtime;
+	int recoverable;     // inode and all of its blocks are still free
+	int block_num;       // directory block holding the entry
+	int offset;          // offset of the entry within that block
+	int gap_end;         // end of the rec_len of the live entry hiding it
+	int selected;        // to be restored by restore_selected_entries
+};
 
-	// Find the inode to be restored
-	int inode_num_to_be_restored = entry_to_be_restored->inode;
-	struct ext2_inode *restored_inode = get_inode_pointer(inode_num_to_be_restored);
+// Every removed entry found in one directory
+struct deleted_index {
+	int dir_num;
+	struct deleted_entry *entries;
+	int count;
+	int space;
+};
 
-	// if inode is used by other sources, then restore is not possible
-	if (get_inode_bit_value(inode_num_to_be_restored) == 1) {
-		exit(EEXIST);
+// The smallest rec_len an entry with this name length can have
+int min_rec_len(int name_len) {
+	return (8 + name_len + 3) & ~3;
+}
+
+// Checks whether the bytes at offset of a gap ending at gap_end look like a
+// removed directory entry
+int is_plausible_entry(struct ext2_dir_entry *entry, int offset, int gap_end) {
+	if (offset + 8 > gap_end || entry->inode == 0 || entry->inode > sb->s_inodes_count) {
+		return 0;
+	}
+	if (entry->name_len == 0 || entry->file_type >= EXT2_FT_MAX) {
+		return 0;
+	}
+	if (offset + min_rec_len(entry->name_len) > gap_end) {
+		return 0;
+	}
+	if (entry->rec_len < min_rec_len(entry->name_len) || entry->rec_len % 4 != 0
+		|| offset + entry->rec_len > gap_end) {
+		return 0;
+	}
+	int i;
+	for (i = 0; i < entry->name_len; i++) {
+		if (entry->name[i] == '\0' || entry->name[i] == '/') {
+			return 0;
+		}
 	}
-	// Continue re-enab-ing
-	update_inode_bitmap(inode_num_to_be_restored, 1);
+	return 1;
+}
 
-	// Read from the re-enabled inode, restore the nesseary values
-	restored_inode->i_links_count += 1;
-	restored_inode->i_dtime = 0;
-	int indirect_iterations = 0;
+// Checks whether the inode and every block it uses are still unallocated
+int inode_is_recoverable(int inode_num) {
+	if (get_inode_bit_value(inode_num) == 1) {
+		return 0;
+	}
+	struct ext2_inode *inode = get_inode_pointer(inode_num);
+	int block_nums[MAX_INODE_BLOCKS];
+	int count = collect_inode_blocks(inode, block_nums);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (block_nums[i] > sb->s_blocks_count || get_block_bit_value(block_nums[i]) == 1) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
-	// re-enable the blocks of the inode
-	int iteration_counts = (restored_inode->i_blocks)/2;
-	if (iteration_counts >= 13){
-		indirect_iterations = iteration_counts - 12;
-		iteration_counts = 12;
+void add_deleted_entry(struct deleted_index *index, struct ext2_dir_entry *entry,
+						int block_num, int offset, int gap_end) {
+	if (index->count == index->space) {
+		index->space = index->space ? index->space * 2 : 16;
+		index->entries = realloc(index->entries, index->space * sizeof(struct deleted_entry));
 	}
+	struct deleted_entry *deleted = &index->entries[index->count++];
+	strncpy(deleted->name, entry->name, entry->name_len);
+	deleted->name[entry->name_len] = '\0';
+	deleted->inode = entry->inode;
+	deleted->file_type = entry->file_type;
+	deleted->dtime = get_inode_pointer(entry->inode)->i_dtime;
+	deleted->recoverable = inode_is_recoverable(entry->inode);
+	deleted->block_num = block_num;
+	deleted->offset = offset;
+	deleted->gap_end = gap_end;
+	deleted->selected = 0;
+}
+
+// Walks the whole rec_len slack of every live entry in the directory and
+// records every removed entry found in it, in directory order. Several
+// entries removed back to back all live in the same gap.
+void scan_deleted_entries(int dir_num, struct deleted_index *index) {
+	struct ext2_inode *dir = get_inode_pointer(dir_num);
+	index->dir_num = dir_num;
+	index->count = 0;
+	prefetch_inode_blocks(dir);
 
 	int i;
-	for (i=0; i<iteration_counts; i++){			
-		update_block_bitmap(restored_inode->i_block[i], 1);
+	for (i = 0; i < 12; i++) {
+		int block_num = dir->i_block[i];
+		if (block_num == 0) {
+			continue;
+		}
+		int offset = 0;
+		while (offset < EXT2_BLOCK_SIZE) {
+			struct ext2_dir_entry *live_entry = get_dir_entry_pointer(block_num, offset);
+			if (live_entry->rec_len == 0) {
+				break;
+			}
+			int gap_end = offset + live_entry->rec_len;
+			int candidate = offset + min_rec_len(live_entry->name_len);
+			while (candidate < gap_end) {
+				struct ext2_dir_entry *hidden = get_dir_entry_pointer(block_num, candidate);
+				if (is_plausible_entry(hidden, candidate, gap_end)) {
+					add_deleted_entry(index, hidden, block_num, candidate, gap_end);
+					// the next removed entry, if any, starts right after this one
+					candidate += min_rec_len(hidden->name_len);
+				} else {
+					candidate += 4;
+				}
+			}
+			offset = gap_end;
+		}
 	}
+}
 
-	if (indirect_iterations) {
-		int j;
+// Directories restored with -r whose own entries still have to be restored
+static int recursive;
+static int *dir_queue;
+static int queue_head;
+static int queue_tail;
+static int queue_space;
 
-		// Index 12 is the pointer to a indirect block
-		int *indirect_blocks = (int *) get_dir_entry_pointer(
-		restored_inode->i_block[12], 0);
+// Bits set since the counters were last updated
+static int blocks_taken;
+static int inodes_taken;
+static int dirs_restored;
 
-		for (j=0; j<indirect_iterations; j++){
-			// set all blocks found in indirect blocks into 0
-			if (indirect_blocks[j]) {
-			update_block_bitmap(indirect_blocks[j], 1);
-			}
+// Entries of restored directories dropped because their inode was reused
+static int entries_lost;
+
+// One bit per inode brought back by this run, whose other names add links
+static unsigned char *restored_inodes;
+
+void queue_directory(int dir_num) {
+	if (queue_tail == queue_space) {
+		queue_space = queue_space ? queue_space * 2 : 64;
+		dir_queue = realloc(dir_queue, queue_space * sizeof(int));
+	}
+	dir_queue[queue_tail++] = dir_num;
+}
+
+// Writes the bits set since the last call into the superblock and group
+// descriptor counters at once and ends the operation.
+void update_restore_counts() {
+	adjust_free_counts(-blocks_taken, -inodes_taken);
+	if (dirs_restored) {
+		dirty_metadata_block(2);
+		gd->bg_used_dirs_count += dirs_restored;
+	}
+	blocks_taken = 0;
+	inodes_taken = 0;
+	dirs_restored = 0;
+	end_operation();
+}
+
+// Selects the most recently removed recoverable entry with the given name.
+// Returns 0 if one was selected, EEXIST if the name was found but cannot be
+// recovered, EISDIR if it is a directory and -r was not given, and ENOENT if
+// it was not found.
+int select_deleted_entry(struct deleted_index *index, char *name) {
+	int found = 0;
+	int best = -1;
+	int i;
+	for (i = 0; i < index->count; i++) {
+		struct deleted_entry *entry = &index->entries[i];
+		if (strcmp(entry->name, name) != 0) {
+			continue;
 		}
-		update_block_bitmap(restored_inode->i_block[12], 1);
+		found = 1;
+		if (entry->recoverable && (best == -1 || entry->dtime >= index->entries[best].dtime)) {
+			best = i;
+		}
+	}
+	if (best == -1) {
+		return found ? EEXIST : ENOENT;
+	}
+	// a directory cannot come back without the entries inside it
+	if (!recursive && find_filetype(get_inode_pointer(index->entries[best].inode)->i_mode) == 'd') {
+		return EISDIR;
 	}
+	index->entries[best].selected = 1;
+	return 0;
 }
 
-// The function should just do the reverse of remove
-// Since the parent inode is known; serach through all the blocks in parent
-// inode to see if there exist the file to be restored. 
-void restore_vicitim_at_inode(int parent_inode_num, char* restore_name){
-	// After determining a filesystem that should be restored; 
-	// following will be done: 
-	// - Re-enable vicitim's inode if not enabled
-	// - Re-enable block
-	// - incrememnt hardlink count for the inode-to-be-restored
-	// - Restore rec-len to its proper amount
+// Selects every recoverable entry, one per name.
+int select_all_deleted_entries(struct deleted_index *index) {
+	int selected = 0;
+	int i;
+	for (i = 0; i < index->count; i++) {
+		if (index->entries[i].recoverable && !index->entries[i].selected
+			&& find_token_in_dir(index->dir_num, index->entries[i].name) == -1
+			&& select_deleted_entry(index, index->entries[i].name) == 0) {
+			selected += 1;
+		}
+	}
+	return selected;
+}
 
-	struct ext2_inode *parent_inode = get_inode_pointer(parent_inode_num);
+// Re-enables the inode referenced by an entry of directory parent_num and
+// its blocks. Bitmap bits are set directly; the free counters are updated
+// later by update_restore_counts. A restored directory regains the link
+// of its "." entry and gives its parent back the link of its "..".
+// Another name of a file already restored by this run only adds a link.
+// Returns 0 on success, or EEXIST if the inode or a block has been reused.
+int restore_entry_inode(int inode_num, int parent_num) {
+	if (restored_inodes == NULL) {
+		restored_inodes = calloc(sb->s_inodes_count / 8 + 1, 1);
+	}
+	struct ext2_inode *restored_inode = get_inode_pointer(inode_num);
+	if ((restored_inodes[inode_num / 8] >> (inode_num % 8)) & 1) {
+		if (find_filetype(restored_inode->i_mode) == 'd') {
+			return EEXIST;
+		}
+		dirty_inode(inode_num);
+		restored_inode->i_links_count += 1;
+		return 0;
+	}
+	// an earlier restore in the same pass may have claimed a block
+	if (!inode_is_recoverable(inode_num)) {
+		return EEXIST;
+	}
+	restored_inodes[inode_num / 8] |= 1 << (inode_num % 8);
+	int block_nums[MAX_INODE_BLOCKS];
+	int count = collect_inode_blocks(restored_inode, block_nums);
+	blocks_taken += set_block_bits(block_nums, count, 1);
+	inodes_taken += set_inode_bits(&inode_num, 1, 1);
+
+	dirty_inode(inode_num);
+	restored_inode->i_links_count += 1;
+	restored_inode->i_dtime = 0;
+	if (find_filetype(restored_inode->i_mode) == 'd') {
+		restored_inode->i_links_count += 1;
+		dirty_inode(parent_num);
+		get_inode_pointer(parent_num)->i_links_count += 1;
+		dirs_restored += 1;
+		if (recursive) {
+			queue_directory(inode_num);
+		}
+	}
+	return 0;
+}
+
+// Restores every selected entry of the index in one pass: each entry's inode
+// and blocks are re-enabled and the rec_lens of its gap are split again.
+// Returns the number of entries restored.
+int restore_selected_entries(struct deleted_index *index) {
+	int restored = 0;
+	// the visible entry preceding the next restored one in the same gap
+	int prev_block = -1;
+	int prev_offset = -1;
+	int prev_gap_end = -1;
 
 	int i;
-	for (i=0; i<(parent_inode->i_blocks)/2; i++){
-		struct ext2_dir_entry *current_entry = get_dir_entry_pointer(parent_inode->i_block[i], 0);
-		// struct ext2_dir_entry *last_entry = NULL; 
+	for (i = 0; i < index->count; i++) {
+		struct deleted_entry *entry = &index->entries[i];
+		if (!entry->selected || restore_entry_inode(entry->inode, index->dir_num) != 0) {
+			continue;
+		}
+		dirty_metadata_block(entry->block_num);
+		if (entry->block_num != prev_block || entry->gap_end != prev_gap_end) {
+			// first restore in this gap: the live entry hiding it comes first
+			int offset = 0;
+			struct ext2_dir_entry *live_entry = get_dir_entry_pointer(entry->block_num, offset);
+			while (offset + live_entry->rec_len != entry->gap_end) {
+				offset += live_entry->rec_len;
+				live_entry = get_dir_entry_pointer(entry->block_num, offset);
+			}
+			prev_offset = offset;
+		}
+		struct ext2_dir_entry *prev_entry = get_dir_entry_pointer(entry->block_num, prev_offset);
+		struct ext2_dir_entry *restored_entry = get_dir_entry_pointer(entry->block_num, entry->offset);
+		prev_entry->rec_len = entry->offset - prev_offset;
+		restored_entry->rec_len = entry->gap_end - entry->offset;
+
+		prev_block = entry->block_num;
+		prev_offset = entry->offset;
+		prev_gap_end = entry->gap_end;
+		entry->selected = 0;
+		restored += 1;
+	}
+	return restored;
+}
 
+// Restores the contents of a directory brought back with -r: visible entries
+// whose inode was freed along with the directory, then every recoverable
+// entry hidden in its gaps. A visible entry whose inode or blocks have been
+// reused is unlinked, its rec_len merged into the entry before it, and
+// counted in entries_lost. Subdirectories are queued rather than recursed
+// into, so the depth of the tree does not matter.
+void restore_directory_contents(int dir_num, struct deleted_index *index) {
+	struct ext2_inode *dir = get_inode_pointer(dir_num);
+	int i;
+	for (i = 0; i < 12; i++) {
+		int block_num = dir->i_block[i];
+		if (block_num == 0) {
+			continue;
+		}
+		struct ext2_dir_entry *prev_entry = NULL;
 		int offset = 0;
-		int expected_rec_len = 0;
 		while (offset < EXT2_BLOCK_SIZE) {
-			expected_rec_len = compute_rec_len(current_entry->name_len);
-			// ===== Logic Here ===== // 
-			// If rec_len does not match expected; there should be the deleted entry in here
-			if (expected_rec_len < current_entry->rec_len){
-				// dir_entries that enters this loop are all canadidates for containing a 
-				// "removed" file_entry within it's rec_len
-
-				// Get the ext2_dir_entry that is hidden in current_entry
-				struct ext2_dir_entry *hidden_entry = get_dir_entry_pointer(
-					parent_inode->i_block[i], offset + expected_rec_len);
-
-				if (strncmp(restore_name, hidden_entry->name, strlen(restore_name)) == 0) {
-					// All test case passed, this shall be the file/ext2_dir_entry to be restored
-					restore_dir_entry(hidden_entry, parent_inode, i);
-
-					// Following operations restore pre-rm rec_lens
-					int hidden_rec_len = current_entry->rec_len - expected_rec_len;
-					current_entry->rec_len = expected_rec_len;
-					hidden_entry->rec_len = hidden_rec_len;
-
-					return;
+			struct ext2_dir_entry *entry = get_dir_entry_pointer(block_num, offset);
+			int rec_len = entry->rec_len;
+			if (rec_len == 0) {
+				break;
+			}
+			int is_dot = (entry->name_len == 1 && entry->name[0] == '.')
+				|| (entry->name_len == 2 && strncmp(entry->name, "..", 2) == 0);
+			if (!is_dot && entry->inode != 0 && entry->inode <= sb->s_inodes_count
+				&& restore_entry_inode(entry->inode, dir_num) != 0) {
+				dirty_metadata_block(block_num);
+				if (prev_entry != NULL) {
+					prev_entry->rec_len += rec_len;
+				} else {
+					entry->inode = 0;
 				}
-
+				entries_lost += 1;
+				offset += rec_len;
+				continue;
 			}
-			offset += current_entry->rec_len;
-			// last_entry = current_entry;
-			current_entry = get_dir_entry_pointer(parent_inode->i_block[i], offset);
+			prev_entry = entry;
+			offset += rec_len;
 		}
 	}
+	scan_deleted_entries(dir_num, index);
+	select_all_deleted_entries(index);
+	restore_selected_entries(index);
+	update_restore_counts();
 }
 
-int main (int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <image file name> <path>\n", argv[0]);
-        exit(1);
-    }
-
-    // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
+// Works through the directories queued by -r until the subtree is restored.
+void restore_queued_directories() {
+	struct deleted_index index;
+	memset(&index, 0, sizeof(index));
+	while (queue_head < queue_tail) {
+		restore_directory_contents(dir_queue[queue_head++], &index);
+	}
+	free(index.entries);
+	queue_head = 0;
+	queue_tail = 0;
+}
 
+// Splits path into the inode number of its parent directory (returned) and
+// its basename (stored in child_name). Returns a negative errno on failure.
+int resolve_parent(char *path, char *child_name) {
 	// remove trailing slashes from path
-    remove_trailing_slashes(argv[2]);
+	remove_trailing_slashes(path);
 	// verify that the path starts with '/' indicating absolute path
-    if (verify_absolute_path_structure(argv[2]) == 0) {
-        return ENOENT;
-    }
-    // Error check: absolute path must start from root directory
-    if (strlen(argv[2]) >= 1 && argv[2][0] != '/') {
-        return EINVAL;
-    }
+	if (verify_absolute_path_structure(path) == 0) {
+		return -ENOENT;
+	}
 	// edge case: when the entire path is just the root
-    if (strlen(argv[2]) == 1 && argv[2][0] == '/') {
-		return EEXIST;
-    }
-
-    int parent_num;
-    char child_name[strlen(argv[2]) + 1];
-
-    // find the position of the string at which basename starts
-    int basename_offset = get_basename_offset(argv[2]);
-    if (basename_offset <= 0) {
-        return ENOENT;
-    }
-    
-    // construct the basename string
-    strncpy(child_name, argv[2] + basename_offset, strlen(argv[2]) - basename_offset);
-    child_name[strlen(argv[2]) - basename_offset] = '\0';
-    
-    // find the inode number of the parent directory
-    parent_num = get_parent_inode_num_from_path(argv[2], basename_offset - 1);
-    if (parent_num == -1) {
-        return ENOENT;
-    }
+	if (strlen(path) == 1 && path[0] == '/') {
+		return -EEXIST;
+	}
+	// find the position of the string at which basename starts
+	int basename_offset = get_basename_offset(path);
+	if (basename_offset <= 0) {
+		return -ENOENT;
+	}
+	// construct the basename string
+	strncpy(child_name, path + basename_offset, strlen(path) - basename_offset);
+	child_name[strlen(path) - basename_offset] = '\0';
+
+	// find the inode number of the parent directory
+	int parent_num = get_parent_inode_num_from_path(path, basename_offset - 1);
+	if (parent_num == -1) {
+		return -ENOENT;
+	}
 	struct ext2_inode* parent = get_inode_pointer(parent_num);
 	// parent must be a directory
 	if (find_filetype(parent->i_mode) != 'd') {
-		return ENOTDIR;
+		return -ENOTDIR;
+	}
+	return parent_num;
+}
+
+// Restores the names selected in index and, with -r, everything below the
+// directories among them.
+void finish_directory(struct deleted_index *index) {
+	restore_selected_entries(index);
+	update_restore_counts();
+	restore_queued_directories();
+}
+
+int main (int argc, char **argv) {
+	int a_flag = 0;
+	int arg = 2;
+	while (arg < argc && (strcmp(argv[arg], "-a") == 0 || strcmp(argv[arg], "-r") == 0)) {
+		if (argv[arg][1] == 'a') {
+			a_flag = 1;
+		} else {
+			recursive = 1;
+		}
+		arg++;
 	}
+	if (arg >= argc) {
+		fprintf(stderr, "Usage: %s <image file name> (-r) (-a) <path> [<path> ...]\n", argv[0]);
+		exit(1);
+	}
+
+	// access disk image
+	open_image(argv[1]);
 
-    // ensure that there are enough free blocks and inodes to complete the operation
-    int blocks_needed = 1 + inode_needs_new_block_for_new_dir_entry(parent_num, strlen(child_name));
-    int inodes_needed = 1;
-    if (gd->bg_free_inodes_count < inodes_needed || gd->bg_free_blocks_count < blocks_needed) {
-        return ENOMEM;
-    }
+	struct deleted_index index;
+	memset(&index, 0, sizeof(index));
+	index.dir_num = -1;
+	int status = 0;
 
-    // Enough error checks, run function that does needed operation
+	for (; arg < argc; arg++) {
+		char *path = argv[arg];
+		char child_name[strlen(path) + 1];
 
-    restore_vicitim_at_inode(parent_num, child_name);
+		if (a_flag) {
+			// restore everything recoverable inside the directory at path
+			remove_trailing_slashes(path);
+			int dir_num = EXT2_ROOT_INO;
+			if (strcmp(path, "/") != 0) {
+				int parent_num = resolve_parent(path, child_name);
+				dir_num = parent_num < 0 ? -1 : find_token_in_dir(parent_num, child_name);
+			}
+			if (dir_num == -1 || find_filetype(get_inode_pointer(dir_num)->i_mode) != 'd') {
+				status = ENOENT;
+				continue;
+			}
+			// entries in the trash come back first, their names are then taken
+			trash_restore_all(dir_num);
+			scan_deleted_entries(dir_num, &index);
+			select_all_deleted_entries(&index);
+			finish_directory(&index);
+			index.dir_num = -1;
+			continue;
+		}
+
+		int parent_num = resolve_parent(path, child_name);
+		if (parent_num < 0) {
+			status = -parent_num;
+			continue;
+		}
+		// the name must not be in use again
+		if (find_token_in_dir(parent_num, child_name) != -1) {
+			status = EEXIST;
+			continue;
+		}
+		// an entry removed with ext2_rm -u is a lookup in the trash log
+		if (trash_restore(parent_num, child_name) == 0) {
+			end_operation();
+			continue;
+		}
+		if (parent_num != index.dir_num) {
+			// names are restored per directory, one scan for each
+			finish_directory(&index);
+			scan_deleted_entries(parent_num, &index);
+		}
+		int result = select_deleted_entry(&index, child_name);
+		if (result != 0) {
+			status = result;
+		}
+	}
+	finish_directory(&index);
+	free(index.entries);
+	free(dir_queue);
+	free(restored_inodes);
+	if (entries_lost > 0) {
+		fprintf(stderr, "%d entries could not be restored, their inodes were reused\n", entries_lost);
+		if (status == 0) {
+			status = EEXIST;
+		}
+	}
+	return status;
 }
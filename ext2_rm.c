@@ -11,183 +11,115 @@
 #include <errno.h>
 #include "ext2.h"
 #include "helper.h"
+#include "trash.h"
 
 // Function verifies if the inode at inode_index have at least one hard link,
-// otherwise the inode will be unset.
-void verify_inode(int inode_index){
+// otherwise the inode will be unset. With trim set the freed blocks are
+// punched out of the image file.
+void verify_inode(int inode_index, int trim){
 	struct ext2_inode *victim_inode = get_inode_pointer(inode_index);
 
 	if (victim_inode->i_links_count == 0) {
-		int i;
-		int j;
-		int indirect_iterations = 0;
-
-		// Disable the rest of the blocks
-		int iteration_counts = (victim_inode->i_blocks)/2;
-		if (iteration_counts >= 13){
-			indirect_iterations = iteration_counts - 12;
-			iteration_counts = 12;
-		}
-
-		for (i=0; i<iteration_counts; i++){			
-			update_block_bitmap(victim_inode->i_block[i], 0);
-		}
+		dirty_inode(inode_index);
 
-		if (indirect_iterations) {
-			// Index 12 is the pointer to a indirect block
-			int *indirect_blocks = (int *) get_dir_entry_pointer(
-			victim_inode->i_block[12], 0);
-
-			for (j=0; j<indirect_iterations; j++){
-				// set all blocks found in indirect blocks into 0
-				if (indirect_blocks[j]) {
-				update_block_bitmap(indirect_blocks[j], 0);
-				}
-			}
-			update_block_bitmap(victim_inode->i_block[12], 0);
-		}
+		// Disable every block of the inode, in as few bitmap ranges as possible
+		int block_nums[MAX_INODE_BLOCKS];
+		int count = collect_inode_blocks(victim_inode, block_nums);
+		qsort(block_nums, count, sizeof(int), compare_numbers);
+		int freed_blocks = set_block_bits(block_nums, count, 0);
 
 		// Note deletion time
 		victim_inode->i_dtime = (unsigned int) time(NULL);
 		// Delete the inode by removing it form the field of bitmap
-		update_inode_bitmap(inode_index, 0);
-	}
-}
-
-// Removes the ext2_dir_entry victim_entry with respect to the entry that comes 
-// before it, last_entry
-// Returns the index of the inode that contains the removed item
-int remove_dir_entry(	struct ext2_dir_entry *victim_entry, 
-						struct ext2_dir_entry *last_entry,
-						struct ext2_inode *parent_inode,
-						int i_block_index
-						){
-
-	int victim_inode_index = victim_entry->inode;
-	struct ext2_inode *victim_inode = get_inode_pointer(victim_inode_index);
-
-	// RMB: decrement i_links_count for victim_inode!
-
-	// Few things to check (in order) : 
-	// -	if this file takes up the entire block, 
-	// 		then the block should be unset & disabled and information to be updated to
-	// 		bitmap.
-	// -	If the victim_inode just happens to be the first one in block: set its inode
-	// 		to 0 to invalidate
-	//		
-
-	if (victim_entry->rec_len == EXT2_BLOCK_SIZE){	
-		// Empty this block
-		update_block_bitmap(parent_inode->i_block[i_block_index], 0);
-		parent_inode->i_block[i_block_index] = 0;
-		parent_inode->i_blocks -= 2;
-
-	} else if (last_entry == NULL) {
-		// Set inode to 0 to invalidate
-		victim_entry->inode = 0;
-
-	} else {
-		last_entry->rec_len+= victim_entry->rec_len;
+		int freed_inodes = set_inode_range(inode_index, inode_index + 1, 0);
+		adjust_free_counts(freed_blocks, freed_inodes);
+		if (trim && trim_blocks(block_nums, count) < 0) {
+			perror("trim");
+		}
 	}
-
-	victim_inode->i_links_count--;
-	return victim_inode_index;
-
 }
 
-// Function that removes the file entry with name "victim_name" from parent_inode_num
-void remove_victim_at_inode(int parent_inode_num, char* victim_name){
-
-	// Things to do to garentee removal:
-	//	-	Traverse though the i_block of the parent block, once vimtim is found:
-	//			-	Get victim inode
-	//			-	Use victim's inode to find the block that's associated with it
-	//			-	Remove block
-	//			-	Decrease hard link count in inode as blocks have been decreased
-	//			-	Update the rec_len count for the dir before victim
-
-	struct ext2_inode *parent_inode = get_inode_pointer(parent_inode_num);
-
-	int i;
-	for (i=0; i<(parent_inode->i_blocks)/2; i++){
-		struct ext2_dir_entry *current_entry = get_dir_entry_pointer(parent_inode->i_block[i], 0);
-		struct ext2_dir_entry *last_entry = NULL; // This will become userful in later steps
-
-		// Traverse though this entire block
-		int offset = 0;
-		while (offset < EXT2_BLOCK_SIZE) {
+// Removes the directory dir_num, the entry "victim_name" of parent_num, and
+// everything below it; the bitmaps and counters are updated once for the
+// whole tree. With trim set the freed blocks are punched out of the image
+// file.
+void remove_tree_at_inode(int parent_num, char *victim_name, int dir_num, int trim) {
+	struct release_list inodes = {NULL, 0, 0};
+	struct release_list blocks = {NULL, 0, 0};
 
-			// Check if this dir_entry happens to be the target: the victim to be removed
-			if (strncmp(victim_name, current_entry->name, current_entry->name_len) == 0) {	
+	// unlink the tree from its parent, whose link from the tree's ".." goes too
+	remove_victim_at_inode(parent_num, victim_name);
+	dirty_inode(parent_num);
+	get_inode_pointer(parent_num)->i_links_count--;
 
-				int victim_inode_index = remove_dir_entry(current_entry, last_entry, parent_inode, i);
+	int dirs = release_tree(dir_num, &inodes, &blocks);
 
-				// Now that the dir_entry is gone, check if the inode does not have any hard-links
-				// left, which if is the case, then remove the inode
-				verify_inode(victim_inode_index);
-
-				return;
-			}
-
-			// Update last and curr_dir_entry
-			offset += current_entry->rec_len;
-			last_entry = current_entry;
-			current_entry = get_dir_entry_pointer(parent_inode->i_block[i], offset);
-		}
+	free_released_lists(&inodes, &blocks, dirs);
+	if (trim && trim_blocks(blocks.nums, blocks.count) < 0) {
+		perror("trim");
 	}
-
-
+	free(inodes.nums);
+	free(blocks.nums);
 }
 
 // Main function: takes in args, process them and ensure that they are correct 
 // before passing them into opeartional function rm
 
 int main (int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <image file name> <path>\n", argv[0]);
+    int r_flag = 0;
+    int t_flag = 0;
+    int u_flag = 0;
+    int arg = 2;
+    while (arg < argc && (strcmp(argv[arg], "-r") == 0 || strcmp(argv[arg], "-t") == 0
+                          || strcmp(argv[arg], "-u") == 0)) {
+        if (argv[arg][1] == 'r') {
+            r_flag = 1;
+        } else if (argv[arg][1] == 't') {
+            t_flag = 1;
+        } else {
+            u_flag = 1;
+        }
+        arg++;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "Usage: %s <image file name> (-r) (-t) (-u) <path>\n", argv[0]);
         exit(1);
     }
+    char *path = argv[arg];
 
     // access disk image
-    int fd = open(argv[1], O_RDWR);
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-    sb = (struct ext2_super_block *)(disk + EXT2_BLOCK_SIZE);
-    gd = (struct ext2_group_desc *)(disk + EXT2_BLOCK_SIZE*2);
+    open_image(argv[1]);
 
 	// remove trailing slashes from path
-    remove_trailing_slashes(argv[2]);
+    remove_trailing_slashes(path);
 	// verify that the path starts with '/' indicating absolute path
-    if (verify_absolute_path_structure(argv[2]) == 0) {
+    if (verify_absolute_path_structure(path) == 0) {
         return ENOENT;
     }
     // Error check: absolute path must start from root directory
-    if (strlen(argv[2]) >= 1 && argv[2][0] != '/') {
+    if (strlen(path) >= 1 && path[0] != '/') {
         return EINVAL;
     }
     // corner case
-    if (strlen(argv[2]) == 1 && argv[2][0] == '/') {
+    if (strlen(path) == 1 && path[0] == '/') {
         return EINVAL;
     }
 
     int parent_num;
-    char child_name[strlen(argv[2]) + 1];
+    char child_name[strlen(path) + 1];
     
     // find the position of the string at which basename starts
-    int basename_offset = get_basename_offset(argv[2]);
+    int basename_offset = get_basename_offset(path);
     if (basename_offset <= 0) {
         return ENOENT;
     }
     
     // construct the basename string
-    strncpy(child_name, argv[2] + basename_offset, strlen(argv[2]) - basename_offset);
-    child_name[strlen(argv[2]) - basename_offset] = '\0';
+    strncpy(child_name, path + basename_offset, strlen(path) - basename_offset);
+    child_name[strlen(path) - basename_offset] = '\0';
     
     // find the inode number of the parent directory
-    parent_num = get_parent_inode_num_from_path(argv[2], basename_offset - 1);
+    parent_num = get_parent_inode_num_from_path(path, basename_offset - 1);
     if (parent_num == -1) {
         return ENOENT;
     }
@@ -203,12 +135,25 @@ int main (int argc, char **argv) {
     } else {
 		struct ext2_inode* child = get_inode_pointer(child_num);
 		// if child exists but is a directory
-		if (find_filetype(child->i_mode) == 'd') {
+		if (find_filetype(child->i_mode) == 'd' && !r_flag) {
 			return ENOENT; // file not existing
 		}
+		// undoable removal: park the entry in the trash, nothing is freed
+		if (u_flag) {
+			return trash_entry(parent_num, child_name);
+		}
+		if (find_filetype(child->i_mode) == 'd') {
+			remove_tree_at_inode(parent_num, child_name, child_num, t_flag);
+			return 0;
+		}
 	}
 
 	// perform "remove" operation
-    remove_victim_at_inode(parent_num, child_name);
+	int victim_inode_index = remove_victim_at_inode(parent_num, child_name);
+
+	// Now that the dir_entry is gone, check if the inode does not have any hard-links
+	// left, which if is the case, then remove the inode
+	verify_inode(victim_inode_index, t_flag);
+	return 0;
 
 }
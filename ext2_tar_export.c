@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+#include "trash.h"
+#include "tar.h"
+#include "iov.h"
+
+static unsigned char zero_block[EXT2_BLOCK_SIZE];
+
+static struct iov_writer out;
+
+
+// ------------------- headers -----------------------
+
+/*
+    Put name in the header, split over the prefix and name fields if it is
+    longer than the name field. Returns 0, or -1 if it fits neither way.
+ */
+static int set_header_name(struct tar_header *header, char *name) {
+    int length = strlen(name);
+    if (length <= (int) sizeof(header->t_name)) {
+        memcpy(header->t_name, name, length);
+        return 0;
+    }
+    // split at a slash leaving at most 100 bytes for the name field
+    char *slash = strchr(name + length - sizeof(header->t_name) - 1, '/');
+    if (slash == NULL || slash - name > (int) sizeof(header->t_prefix) || slash[1] == '\0') {
+        return -1;
+    }
+    memcpy(header->t_prefix, name, slash - name);
+    memcpy(header->t_name, slash + 1, length - (slash - name) - 1);
+    return 0;
+}
+
+/*
+    Queue a GNU long-name entry ('L' or 'K') carrying text, for a name or
+    link target the header cannot hold. The entry is built in buffer, which
+    must stay alive until the next flush.
+    Returns the bytes of buffer used, or -1 if stdout fails.
+ */
+static int output_long_name(char type, char *text, char *buffer) {
+    int length = strlen(text) + 1;
+    int used = TAR_RECORD_SIZE + length + tar_padding(length);
+    struct tar_header *header = (struct tar_header *) buffer;
+    memset(buffer, 0, used);
+    strcpy(header->t_name, "././@LongLink");
+    tar_set_number(header->t_mode, sizeof(header->t_mode), 0644);
+    tar_set_number(header->t_uid, sizeof(header->t_uid), 0);
+    tar_set_number(header->t_gid, sizeof(header->t_gid), 0);
+    tar_set_number(header->t_size, sizeof(header->t_size), length);
+    tar_set_number(header->t_mtime, sizeof(header->t_mtime), 0);
+    header->t_typeflag = type;
+    tar_finish_header(header);
+    memcpy(buffer + TAR_RECORD_SIZE, text, length);
+    return iov_queue(&out, buffer, used) == 0 ? used : -1;
+}
+
+/*
+    Queue the header of the entry for inode_num named name, with link the
+    hard link or symlink target where there is one. Returns 0, or -1 if
+    stdout fails.
+ */
+static int output_header(char *name, int inode_num, char type, long long size, char *link) {
+    // the buffer is reused for every entry: send off what points into it
+    if (iov_flush(&out) != 0) {
+        return -1;
+    }
+    // room for a long-name entry for each of name and link, and the header;
+    // paths in the image have no length limit, so it grows to fit
+    static char *buffer;
+    static size_t buffer_size;
+    size_t needed = 2 * TAR_RECORD_SIZE + strlen(name) + 1 + TAR_RECORD_SIZE;
+    if (link != NULL) {
+        needed += 2 * TAR_RECORD_SIZE + strlen(link) + 1;
+    }
+    if (needed > buffer_size) {
+        buffer = realloc(buffer, needed);
+        buffer_size = needed;
+    }
+    char *next = buffer;
+
+    struct tar_header header;
+    memset(&header, 0, sizeof(header));
+    if (set_header_name(&header, name) != 0) {
+        int used = output_long_name(TAR_GNU_LONGNAME, name, next);
+        if (used < 0) {
+            return -1;
+        }
+        next += used;
+        memcpy(header.t_name, name, sizeof(header.t_name));
+    }
+    if (link != NULL) {
+        if (strlen(link) > sizeof(header.t_linkname)) {
+            int used = output_long_name(TAR_GNU_LONGLINK, link, next);
+            if (used < 0) {
+                return -1;
+            }
+            next += used;
+        }
+        memcpy(header.t_linkname, link, strnlen(link, sizeof(header.t_linkname)));
+    }
+
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    tar_set_number(header.t_mode, sizeof(header.t_mode), inode->i_mode & 07777);
+    tar_set_number(header.t_uid, sizeof(header.t_uid), inode->i_uid);
+    tar_set_number(header.t_gid, sizeof(header.t_gid), inode->i_gid);
+    tar_set_number(header.t_size, sizeof(header.t_size), size);
+    tar_set_number(header.t_mtime, sizeof(header.t_mtime), inode->i_mtime);
+    header.t_typeflag = type;
+    tar_finish_header(&header);
+    memcpy(next, &header, TAR_RECORD_SIZE);
+    return iov_queue(&out, next, TAR_RECORD_SIZE);
+}
+
+
+// ------------------- entries -----------------------
+
+/*
+    Queue the data of the file inode_num: each block is a pointer into the
+    block layer, and blocks that are adjacent in memory, as runs of the
+    mapping are, merge into one piece. Unmapped blocks (holes) read as
+    zeroes. Returns 0, or -1 if stdout fails.
+ */
+static int output_file_data(int inode_num) {
+    int size = get_inode_pointer(inode_num)->i_size;
+    int block_count = (size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    int block_nums[MAX_FILE_BLOCKS];
+    block_count = map_file_range(inode_num, 0, block_count, block_nums);
+    int i;
+    for (i = 0 ; i < block_count ; i++) {
+        int length = size - i * EXT2_BLOCK_SIZE < EXT2_BLOCK_SIZE ? size - i * EXT2_BLOCK_SIZE : EXT2_BLOCK_SIZE;
+        void *data = block_nums[i] != 0 ? get_block(block_nums[i]) : zero_block;
+        if (iov_queue(&out, data, length) != 0) {
+            return -1;
+        }
+    }
+    if (iov_queue(&out, zero_block, tar_padding(size)) != 0) {
+        return -1;
+    }
+    return iov_flush(&out);
+}
+
+/*
+    Queue the entry for inode_num, archived as name. A file with more than
+    one link is written once; its other names become hard links to the
+    first, which is remembered in first_names.
+    Returns 0, or -1 if stdout fails.
+ */
+static int output_entry(char *name, int inode_num, char **first_names) {
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    char type = find_filetype(inode->i_mode);
+    if (type == 'd') {
+        char dir_name[strlen(name) + 2];
+        sprintf(dir_name, "%s/", name);
+        return output_header(dir_name, inode_num, TAR_DIRECTORY, 0, NULL);
+    }
+    if (inode->i_links_count > 1) {
+        if (first_names[inode_num] != NULL) {
+            return output_header(name, inode_num, TAR_HARDLINK, 0, first_names[inode_num]);
+        }
+        first_names[inode_num] = strdup(name);
+    }
+    if (type == 'l') {
+        char target[EXT2_BLOCK_SIZE + 1];
+        int length = inode->i_size < EXT2_BLOCK_SIZE ? inode->i_size : EXT2_BLOCK_SIZE;
+        if (inode_is_fast_symlink(inode)) {
+            memcpy(target, inode->i_block, length);
+        } else {
+            memcpy(target, get_block(inode->i_block[0]), length);
+        }
+        target[length] = '\0';
+        return output_header(name, inode_num, TAR_SYMLINK, 0, target);
+    }
+    if (output_header(name, inode_num, TAR_REGULAR, inode->i_size, NULL) != 0) {
+        return -1;
+    }
+    return output_file_data(inode_num);
+}
+
+struct pending_entry {
+    char *name;      // path inside the archive
+    int inode_num;
+};
+
+/*
+    Add the entries of directory dir_num, named below prefix, to the stack
+    so that they are popped in directory order. The trash is left out of
+    an export of the root.
+ */
+static void push_dir_entries(int dir_num, char *prefix, struct pending_entry **stack, int *count, int *space) {
+    struct ext2_inode *dir = get_inode_pointer(dir_num);
+    int first = *count;
+    int i;
+    for (i = 0 ; i < 12 && dir->i_block[i] != 0 ; i++) {
+        int block_offset = 0;
+        while (block_offset < EXT2_BLOCK_SIZE) {
+            struct ext2_dir_entry *entry = get_dir_entry_pointer(dir->i_block[i], block_offset);
+            block_offset += entry->rec_len;
+            if (entry->inode == 0 || entry->rec_len == 0) {
+                if (entry->rec_len == 0) {
+                    break;
+                }
+                continue;
+            }
+            if ((entry->name_len == 1 && entry->name[0] == '.')
+                || (entry->name_len == 2 && strncmp(entry->name, "..", 2) == 0)) {
+                continue;
+            }
+            if (dir_num == EXT2_ROOT_INO && entry->name_len == strlen(TRASH_DIR_NAME)
+                && strncmp(entry->name, TRASH_DIR_NAME, entry->name_len) == 0) {
+                continue;
+            }
+            if (*count == *space) {
+                *space = *space * 2 + 64;
+                *stack = realloc(*stack, *space * sizeof(struct pending_entry));
+            }
+            char *name = malloc(strlen(prefix) + entry->name_len + 2);
+            sprintf(name, "%s%s%.*s", prefix, prefix[0] == '\0' ? "" : "/", entry->name_len, entry->name);
+            (*stack)[*count].name = name;
+            (*stack)[*count].inode_num = entry->inode;
+            *count += 1;
+        }
+    }
+    // reverse the entries just pushed so that the first is on top
+    int last = *count - 1;
+    while (first < last) {
+        struct pending_entry swap = (*stack)[first];
+        (*stack)[first] = (*stack)[last];
+        (*stack)[last] = swap;
+        first += 1;
+        last -= 1;
+    }
+}
+
+
+// Writes the subtree at path as a tar archive to stdout, with names
+// relative to it; a file is archived under its own name.
+int main (int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <image file name> <path>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+    iov_writer_init(&out, STDOUT_FILENO);
+
+    if (verify_absolute_path_structure(argv[2]) == 0) {
+        return ENOENT;
+    }
+    remove_trailing_slashes(argv[2]);
+    int top_num = lookup_path(EXT2_ROOT_INO, argv[2]);
+    if (top_num == -1) {
+        return ENOENT;
+    }
+
+    char **first_names = calloc(sb->s_inodes_count + 1, sizeof(char *));
+    struct pending_entry *stack = NULL;
+    int count = 0;
+    int space = 0;
+    int status = 0;
+    if (find_filetype(get_inode_pointer(top_num)->i_mode) == 'd') {
+        push_dir_entries(top_num, "", &stack, &count, &space);
+    } else {
+        char *slash = strrchr(argv[2], '/');
+        status = output_entry(slash + 1, top_num, first_names);
+    }
+    while (count > 0 && status == 0) {
+        struct pending_entry entry = stack[--count];
+        status = output_entry(entry.name, entry.inode_num, first_names);
+        if (status == 0 && find_filetype(get_inode_pointer(entry.inode_num)->i_mode) == 'd') {
+            push_dir_entries(entry.inode_num, entry.name, &stack, &count, &space);
+        }
+        free(entry.name);
+        end_operation();
+    }
+
+    // the end of the archive: two zero records
+    if (status == 0) {
+        status = iov_queue(&out, zero_block, 2 * TAR_RECORD_SIZE);
+    }
+    if (status == 0) {
+        status = iov_flush(&out);
+    }
+    if (status != 0) {
+        perror("write");
+        return EIO;
+    }
+    return 0;
+}
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "ext2.h"
+#include "helper.h"
+#include "hash.h"
+#include "tar.h"
+
+#define TAR_PATH_MAX 4096
+#define PAX_HEADER_MAX 65536
+
+static int tar_fd;
+static int dedupe;  // -d: link identical read-only files
+
+
+/*
+    Read exactly length bytes of the archive into buffer.
+    Returns 0 on success, -1 if the archive ends early or cannot be read.
+ */
+static int read_archive(void *buffer, long long length) {
+    char *position = buffer;
+    while (length > 0) {
+        ssize_t got = read(tar_fd, position, length);
+        if (got <= 0) {
+            return -1;
+        }
+        position += got;
+        length -= got;
+    }
+    return 0;
+}
+
+// Read and drop length bytes of the archive, such as an entry not imported.
+static int skip_archive(long long length) {
+    char buffer[16 * TAR_RECORD_SIZE];
+    while (length > 0) {
+        int chunk = length < (long long) sizeof(buffer) ? length : (int) sizeof(buffer);
+        if (read_archive(buffer, chunk) != 0) {
+            return -1;
+        }
+        length -= chunk;
+    }
+    return 0;
+}
+
+
+// ------------------- -d: files already imported, by contents -----------------
+
+struct imported_file {
+    unsigned long long hash;
+    int size;
+    int inode_num;           // 0 for an empty slot
+};
+
+static struct imported_file *imported;
+static int imported_count;
+static int imported_slots;
+
+/*
+    Returns 1 if the files inode_a and inode_b have the same contents.
+ */
+static int files_equal(int inode_a, int inode_b) {
+    int size = get_inode_pointer(inode_a)->i_size;
+    if (get_inode_pointer(inode_b)->i_size != size) {
+        return 0;
+    }
+    int offset;
+    for (offset = 0 ; offset < size ; offset += EXT2_BLOCK_SIZE) {
+        int length = size - offset < EXT2_BLOCK_SIZE ? size - offset : EXT2_BLOCK_SIZE;
+        int block_a = map_file_block(inode_a, offset / EXT2_BLOCK_SIZE, 0);
+        int block_b = map_file_block(inode_b, offset / EXT2_BLOCK_SIZE, 0);
+        if (block_a <= 0 || block_b <= 0 || memcmp(get_block(block_a), get_block(block_b), length) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void insert_imported(unsigned long long hash, int size, int inode_num) {
+    int slot = (hash ^ size) & (imported_slots - 1);
+    while (imported[slot].inode_num != 0) {
+        slot = (slot + 1) & (imported_slots - 1);
+    }
+    imported[slot].hash = hash;
+    imported[slot].size = size;
+    imported[slot].inode_num = inode_num;
+    imported_count += 1;
+}
+
+/*
+    Look the new file inode_num up among the read-only files imported
+    before it by the hash of its contents. Returns the inode of an earlier
+    file with the same contents, or -1 after recording inode_num as the
+    first of its contents.
+ */
+static int find_same_file(unsigned long long hash, int size, int inode_num) {
+    if (imported_count * 2 >= imported_slots) {
+        // grow the table, keeping it at most half full
+        struct imported_file *old = imported;
+        int old_slots = imported_slots;
+        imported_slots = imported_slots == 0 ? 256 : imported_slots * 2;
+        imported = calloc(imported_slots, sizeof(struct imported_file));
+        imported_count = 0;
+        int i;
+        for (i = 0 ; i < old_slots ; i++) {
+            if (old[i].inode_num != 0) {
+                insert_imported(old[i].hash, old[i].size, old[i].inode_num);
+            }
+        }
+        free(old);
+    }
+    int slot = (hash ^ size) & (imported_slots - 1);
+    while (imported[slot].inode_num != 0) {
+        // equal hashes are only trusted once the contents compare equal
+        if (imported[slot].hash == hash && imported[slot].size == size
+            && files_equal(imported[slot].inode_num, inode_num)) {
+            return imported[slot].inode_num;
+        }
+        slot = (slot + 1) & (imported_slots - 1);
+    }
+    insert_imported(hash, size, inode_num);
+    return -1;
+}
+
+
+// ------------------- creating entries -----------------------
+
+/*
+    Check that an entry name with an inode needing blocks data blocks (and
+    inodes inodes) can be added to the directory dir_num.
+    Returns 0, or the errno to fail with.
+ */
+static int check_new_entry(int dir_num, char *name, int blocks, int inodes) {
+    // an empty name is the directory itself
+    if (name[0] == '\0' || find_token_in_dir(dir_num, name) != -1) {
+        return EEXIST;
+    }
+    if (strlen(name) > EXT2_NAME_LEN) {
+        return ENAMETOOLONG;
+    }
+    // a directory has no more than 12 blocks of entries
+    if (first_available_i_block(dir_num, strlen(name)) == -1) {
+        return ENOSPC;
+    }
+    if (!ensure_free_space(blocks + inode_needs_new_block_for_new_dir_entry(dir_num, strlen(name)), inodes)) {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+// Take the permission bits and the modification time from the header.
+static void set_attributes(int inode_num, struct tar_header *header) {
+    dirty_inode(inode_num);
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    inode->i_mode = (inode->i_mode & ~07777) | (tar_get_number(header->t_mode, sizeof(header->t_mode)) & 07777);
+    inode->i_mtime = tar_get_number(header->t_mtime, sizeof(header->t_mtime));
+}
+
+// Archive paths must stay below the destination.
+static int has_dot_dot(char *path) {
+    char *component = path;
+    while (component != NULL) {
+        if (strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0')) {
+            return 1;
+        }
+        component = strchr(component, '/');
+        if (component != NULL) {
+            component += 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Find the directory holding the last component of path below dir_num,
+    creating missing directories on the way like mkdir -p, and store the
+    last component in name (empty when path names dir_num itself).
+    Returns the directory's inode number, or a negative errno.
+ */
+static int make_parent_dirs(int dir_num, char *path, char *name) {
+    name[0] = '\0';
+    char *component = path;
+    while (*component != '\0') {
+        char *slash = strchr(component, '/');
+        int length = slash == NULL ? strlen(component) : slash - component;
+        char *rest = component + length;
+        while (*rest == '/') {
+            rest += 1;
+        }
+        if (length == 0 || (length == 1 && component[0] == '.')) {
+            component = rest;
+            continue;
+        }
+        if (length > EXT2_NAME_LEN) {
+            return -ENAMETOOLONG;
+        }
+        if (*rest == '\0') {
+            memcpy(name, component, length);
+            name[length] = '\0';
+            return dir_num;
+        }
+        char part[length + 1];
+        memcpy(part, component, length);
+        part[length] = '\0';
+        int next_num = find_token_in_dir(dir_num, part);
+        if (next_num == -1) {
+            int status = check_new_entry(dir_num, part, 1, 1);
+            if (status != 0) {
+                return -status;
+            }
+            next_num = find_first_available_inode();
+            status = make_directory(dir_num, part, next_num);
+            if (status != 0) {
+                update_inode_bitmap(next_num, 0);
+                return -status;
+            }
+            dirty_inode(next_num);
+            get_inode_pointer(next_num)->i_mode |= 0755;
+        } else if (find_filetype(get_inode_pointer(next_num)->i_mode) != 'd') {
+            return -ENOTDIR;
+        }
+        dir_num = next_num;
+        component = rest;
+    }
+    return dir_num;
+}
+
+// Give back a file whose import failed; it is not linked anywhere yet.
+static void discard_file(int inode_num) {
+    release_file_blocks(inode_num, 0);
+    dirty_inode(inode_num);
+    get_inode_pointer(inode_num)->i_dtime = time(NULL);
+    update_inode_bitmap(inode_num, 0);
+}
+
+/*
+    Create the regular file name in dir_num from the next size bytes of
+    the archive. The data is read straight into the file's blocks, which
+    are allocated one after the other, so each file is contiguous.
+    Returns 0, or an errno; EIO means the archive itself failed.
+ */
+static int import_file(int dir_num, char *name, long long size, struct tar_header *header) {
+    long long blocks = (size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    int status = blocks > MAX_FILE_BLOCKS ? EFBIG : check_new_entry(dir_num, name, blocks + (blocks > 12), 1);
+    if (status != 0) {
+        return skip_archive(size + tar_padding(size)) == 0 ? status : EIO;
+    }
+    int inode_num = find_first_available_inode();
+    struct ext2_inode *inode = make_inode(inode_num, 'f');
+    inode->i_size = size;
+    set_attributes(inode_num, header);
+
+    struct hash_state hash;
+    hash_init(&hash, 0);
+    int file_block;
+    for (file_block = 0 ; file_block < blocks ; file_block++) {
+        int length = size - (long long) file_block * EXT2_BLOCK_SIZE;
+        if (length > EXT2_BLOCK_SIZE) {
+            length = EXT2_BLOCK_SIZE;
+        }
+        int block_num = map_file_block(inode_num, file_block, 1);
+        dirty_data_block(block_num);
+        unsigned char *data = get_block(block_num);
+        if (read_archive(data, length) != 0) {
+            discard_file(inode_num);
+            return EIO;
+        }
+        memset(data + length, 0, EXT2_BLOCK_SIZE - length);
+        if (dedupe) {
+            hash_update(&hash, data, length);
+        }
+        // keep writes of finished blocks in flight while reading the next ones
+        if ((file_block + 1) % 32 == 0) {
+            start_writeback();
+        }
+    }
+    if (skip_archive(tar_padding(size)) != 0) {
+        discard_file(inode_num);
+        return EIO;
+    }
+
+    int mode = tar_get_number(header->t_mode, sizeof(header->t_mode));
+    if (dedupe && size > 0 && (mode & 0222) == 0) {
+        int same_num = find_same_file(hash_final(&hash), size, inode_num);
+        if (same_num != -1) {
+            // identical read-only contents: link to the copy already made
+            discard_file(inode_num);
+            return make_dir_entry_in_inode(dir_num, name, same_num, 'f');
+        }
+    }
+    status = make_dir_entry_in_inode(dir_num, name, inode_num, 'f');
+    if (status != 0) {
+        discard_file(inode_num);
+    }
+    return status;
+}
+
+static int import_directory(int dir_num, char *name, struct tar_header *header) {
+    if (name[0] == '\0') {
+        // the destination itself keeps its attributes
+        return 0;
+    }
+    int existing_num = find_token_in_dir(dir_num, name);
+    if (existing_num != -1) {
+        if (find_filetype(get_inode_pointer(existing_num)->i_mode) != 'd') {
+            return EEXIST;
+        }
+        set_attributes(existing_num, header);
+        return 0;
+    }
+    int status = check_new_entry(dir_num, name, 1, 1);
+    if (status != 0) {
+        return status;
+    }
+    int new_num = find_first_available_inode();
+    status = make_directory(dir_num, name, new_num);
+    if (status != 0) {
+        update_inode_bitmap(new_num, 0);
+        return status;
+    }
+    set_attributes(new_num, header);
+    return 0;
+}
+
+static int import_symlink(int dir_num, char *name, char *target, struct tar_header *header) {
+    if (strlen(target) >= EXT2_BLOCK_SIZE) {
+        return ENAMETOOLONG;
+    }
+    int status = check_new_entry(dir_num, name, strlen(target) >= EXT2_FAST_SYMLINK_MAX, 1);
+    if (status != 0) {
+        return status;
+    }
+    int new_num = find_first_available_inode();
+    status = make_symlink(dir_num, name, target, new_num);
+    if (status != 0) {
+        update_inode_bitmap(new_num, 0);
+        return status;
+    }
+    set_attributes(new_num, header);
+    return 0;
+}
+
+// A hard link names an entry imported earlier, relative to the destination.
+static int import_hardlink(int dest_num, int dir_num, char *name, char *target) {
+    int target_num = has_dot_dot(target) ? -1 : lookup_path(dest_num, target);
+    if (target_num == -1) {
+        return ENOENT;
+    }
+    char type = find_filetype(get_inode_pointer(target_num)->i_mode);
+    if (type == 'd') {
+        return EPERM;
+    }
+    int status = check_new_entry(dir_num, name, 0, 0);
+    if (status != 0) {
+        return status;
+    }
+    // find_filetype calls symlinks 'l', directory entries take 's'
+    return make_dir_entry_in_inode(dir_num, name, target_num, type == 'l' ? 's' : type);
+}
+
+/*
+    Import one archive entry whose header has been read, consuming its data.
+    Returns 0, or an errno; EIO means the archive itself failed.
+ */
+static int import_entry(int dest_num, struct tar_header *header, char *path, char *link, long long size) {
+    char type = header->t_typeflag;
+    int regular = (type == TAR_REGULAR || type == '\0' || type == TAR_CONTIGUOUS);
+    if (!regular && skip_archive(size + tar_padding(size)) != 0) {
+        return EIO;
+    }
+    char name[strlen(path) + 1];
+    int dir_num = has_dot_dot(path) ? -EINVAL : make_parent_dirs(dest_num, path, name);
+    if (dir_num < 0) {
+        if (regular && skip_archive(size + tar_padding(size)) != 0) {
+            return EIO;
+        }
+        return -dir_num;
+    }
+    if (regular) {
+        return import_file(dir_num, name, size, header);
+    } else if (type == TAR_DIRECTORY) {
+        return import_directory(dir_num, name, header);
+    } else if (type == TAR_SYMLINK) {
+        return import_symlink(dir_num, name, link, header);
+    } else if (type == TAR_HARDLINK) {
+        return import_hardlink(dest_num, dir_num, name, link);
+    }
+    fprintf(stderr, "%s: entry type '%c' not supported, skipped\n", path, type);
+    return 0;
+}
+
+/*
+    Pick the path and linkpath records out of a pax extended header; each
+    record is "<length> <key>=<value>\n".
+ */
+static void parse_pax_header(char *records, long long size, char *long_name, char *long_link) {
+    char *record = records;
+    while (record < records + size) {
+        char *key;
+        long length = strtol(record, &key, 10);
+        if (length <= 0 || record + length > records + size || *key != ' ') {
+            return;
+        }
+        key += 1;
+        char *equals = memchr(key, '=', record + length - key);
+        if (equals == NULL) {
+            return;
+        }
+        char *value = equals + 1;
+        int value_length = record + length - 1 - value;
+        char *target = NULL;
+        if (equals - key == 4 && strncmp(key, "path", 4) == 0) {
+            target = long_name;
+        } else if (equals - key == 8 && strncmp(key, "linkpath", 8) == 0) {
+            target = long_link;
+        }
+        if (target != NULL && value_length >= 0 && value_length < TAR_PATH_MAX) {
+            memcpy(target, value, value_length);
+            target[value_length] = '\0';
+        }
+        record += length;
+    }
+}
+
+/*
+    Read the data of an extension entry (GNU long name, pax header) into a
+    new buffer. Returns NULL if it is too large, after skipping it.
+ */
+static char *read_extension(long long size, int *status) {
+    if (size >= PAX_HEADER_MAX) {
+        *status = skip_archive(size + tar_padding(size)) == 0 ? ENAMETOOLONG : EIO;
+        return NULL;
+    }
+    char *data = malloc(size + 1);
+    if (read_archive(data, size) != 0 || skip_archive(tar_padding(size)) != 0) {
+        free(data);
+        *status = EIO;
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+
+int main (int argc, char **argv) {
+    // -d links read-only files with identical contents to a single copy
+    int d_flag = (argc == 5 && strcmp(argv[2], "-d") == 0);
+    if (argc != 4 + d_flag) {
+        fprintf(stderr, "Usage: %s <image file name> (-d) <tar file or -> <path to dest dir>\n", argv[0]);
+        exit(1);
+    }
+    // access disk image
+    open_image(argv[1]);
+    argv += d_flag;
+    dedupe = d_flag;
+
+    if (verify_absolute_path_structure(argv[3]) == 0) {
+        return ENOENT;
+    }
+    int dest_num = lookup_path(EXT2_ROOT_INO, argv[3]);
+    if (dest_num == -1) {
+        return ENOENT;
+    }
+    if (find_filetype(get_inode_pointer(dest_num)->i_mode) != 'd') {
+        return ENOTDIR;
+    }
+    tar_fd = strcmp(argv[2], "-") == 0 ? STDIN_FILENO : open(argv[2], O_RDONLY);
+    if (tar_fd < 0) {
+        return ENOENT;
+    }
+
+    // names too long for the header come in an entry of their own before it
+    char long_name[TAR_PATH_MAX] = "";
+    char long_link[TAR_PATH_MAX] = "";
+    int status = 0;
+    struct tar_header header;
+    while (status != EIO) {
+        if (read_archive(&header, TAR_RECORD_SIZE) != 0) {
+            // an archive without its end records is accepted
+            break;
+        }
+        if (tar_header_is_zero(&header)) {
+            break;
+        }
+        if (!tar_header_valid(&header)) {
+            fprintf(stderr, "invalid tar header\n");
+            status = EINVAL;
+            break;
+        }
+        long long size = tar_get_number(header.t_size, sizeof(header.t_size));
+        char type = header.t_typeflag;
+        if (type == TAR_GNU_LONGNAME || type == TAR_GNU_LONGLINK || type == TAR_PAX_HEADER) {
+            char *data = read_extension(size, &status);
+            if (data == NULL) {
+                continue;
+            }
+            if (type == TAR_PAX_HEADER) {
+                parse_pax_header(data, size, long_name, long_link);
+            } else {
+                snprintf(type == TAR_GNU_LONGNAME ? long_name : long_link, TAR_PATH_MAX, "%s", data);
+            }
+            free(data);
+            continue;
+        }
+        if (type == TAR_PAX_GLOBAL) {
+            if (skip_archive(size + tar_padding(size)) != 0) {
+                status = EIO;
+            }
+            continue;
+        }
+
+        char path[TAR_PATH_MAX];
+        char link[TAR_PATH_MAX];
+        if (long_name[0] != '\0') {
+            strcpy(path, long_name);
+        } else {
+            tar_header_name(&header, path);
+        }
+        if (long_link[0] != '\0') {
+            strcpy(link, long_link);
+        } else {
+            int link_length = strnlen(header.t_linkname, sizeof(header.t_linkname));
+            memcpy(link, header.t_linkname, link_length);
+            link[link_length] = '\0';
+        }
+        long_name[0] = '\0';
+        long_link[0] = '\0';
+
+        int result = import_entry(dest_num, &header, path, link, size);
+        if (result != 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(result));
+            status = result;
+        }
+        end_operation();
+    }
+    if (tar_fd != STDIN_FILENO) {
+        close(tar_fd);
+    }
+    return status;
+}
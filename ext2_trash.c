@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+#include "trash.h"
+
+// Lists the entries removed with ext2_rm -u, or with -p purges them all,
+// freeing their inodes and blocks.
+int main (int argc, char **argv) {
+    int p_flag = (argc == 3 && strcmp(argv[2], "-p") == 0);
+    if (argc != 2 + p_flag) {
+        fprintf(stderr, "Usage: %s <image file name> (-p)\n", argv[0]);
+        exit(1);
+    }
+
+    // access disk image
+    open_image(argv[1]);
+
+    if (p_flag) {
+        int purged = trash_purge();
+        printf("%d entr%s purged\n", purged, purged == 1 ? "y" : "ies");
+        return 0;
+    }
+
+    // one line per trashed entry: inode, parent directory inode, time, name
+    int cursor = 0;
+    int block_num;
+    struct trash_record *record;
+    while ((record = next_trash_record(&cursor, &block_num)) != NULL) {
+        time_t dtime = record->t_dtime;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&dtime));
+        printf("%u\t%u\t%s\t%.*s\n", record->t_inode, record->t_parent, when,
+               record->t_name_len, record->t_name);
+    }
+    return 0;
+}
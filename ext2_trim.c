@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+
+// Punches a hole in the image file over every run of free blocks, so that a
+// sparse image only takes host space for the blocks in use.
+int main (int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <image file name>\n", argv[0]);
+        exit(1);
+    }
+
+    // access disk image
+    open_image(argv[1]);
+    // make sure no freed block is still waiting to be written
+    sync_image();
+
+    unsigned char *bitmap = get_block(gd->bg_block_bitmap);
+    int blocks = 0;
+    int holes = 0;
+    int bit_idx = 0;
+    while (bit_idx < sb->s_blocks_count) {
+        // whole bytes of allocated blocks are skipped at once
+        if (bit_idx % 8 == 0 && bitmap[bit_idx / 8] == 0xff) {
+            bit_idx += 8;
+            continue;
+        }
+        if (bitmap[bit_idx / 8] & (1 << (bit_idx % 8))) {
+            bit_idx += 1;
+            continue;
+        }
+        int run_end = bit_idx + 1;
+        while (run_end < sb->s_blocks_count && !(bitmap[run_end / 8] & (1 << (run_end % 8)))) {
+            run_end += 1;
+        }
+        // bit i of the bitmap is block i + 1
+        if (discard_blocks(bit_idx + 1, run_end - bit_idx) != 0) {
+            perror("trim");
+            return EOPNOTSUPP;
+        }
+        blocks += run_end - bit_idx;
+        holes += 1;
+        bit_idx = run_end;
+    }
+    printf("%d free block(s) in %d range(s) trimmed\n", blocks, holes);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+
+// Shrinks or extends a file to the given size in place through the shared
+// block-map walker. Blocks past the new end are freed; an extension gets
+// zeroed blocks.
+int main (int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <image file name> <path> <size>\n", argv[0]);
+        exit(1);
+    }
+    char *end;
+    long new_size = strtol(argv[3], &end, 10);
+    if (*end != '\0' || new_size < 0) {
+        return EINVAL;
+    }
+    if (new_size > (long) MAX_FILE_BLOCKS * EXT2_BLOCK_SIZE) {
+        return EFBIG;
+    }
+    // access disk image
+    open_image(argv[1]);
+
+    // remove trailing slashes from path
+    remove_trailing_slashes(argv[2]);
+    // verify that the path starts with '/' indicating absolute path
+    if (verify_absolute_path_structure(argv[2]) == 0) {
+        return ENOENT;
+    }
+    int basename_offset = get_basename_offset(argv[2]);
+    if (basename_offset <= 0) {
+        return ENOENT;
+    }
+    int parent_num = get_parent_inode_num_from_path(argv[2], basename_offset - 1);
+    if (parent_num == -1) {
+        return ENOENT;
+    }
+    int file_num = find_token_in_dir(parent_num, argv[2] + basename_offset);
+    if (file_num == -1) {
+        return ENOENT;
+    }
+    struct ext2_inode *file_inode = get_inode_pointer(file_num);
+    if (find_filetype(file_inode->i_mode) != 'f') {
+        return EISDIR;
+    }
+
+    int old_blocks = (file_inode->i_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    int new_blocks = (new_size + EXT2_BLOCK_SIZE - 1) / EXT2_BLOCK_SIZE;
+    if (new_size < file_inode->i_size) {
+        release_file_blocks(file_num, new_blocks);
+        // the tail of the last block must read back as zeros if extended later
+        if (new_size % EXT2_BLOCK_SIZE != 0) {
+            int last_block = map_file_block(file_num, new_blocks - 1, 0);
+            if (last_block > 0) {
+                dirty_data_block(last_block);
+                memset(get_block(last_block) + new_size % EXT2_BLOCK_SIZE, 0,
+                       EXT2_BLOCK_SIZE - new_size % EXT2_BLOCK_SIZE);
+            }
+        }
+    } else if (new_blocks > old_blocks) {
+        if (!ensure_free_space(unmapped_blocks(file_num, new_blocks), 0)) {
+            return ENOMEM;
+        }
+        int file_block;
+        for (file_block = old_blocks ; file_block < new_blocks ; file_block++) {
+            int block_num = map_file_block(file_num, file_block, 1);
+            dirty_data_block(block_num);
+            memset(get_block(block_num), 0, EXT2_BLOCK_SIZE);
+        }
+    }
+    dirty_inode(file_num);
+    file_inode->i_size = new_size;
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <string.h>
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static unsigned long long rotl64(unsigned long long x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, done bytewise so that unaligned data is fine.
+static unsigned long long read64(const unsigned char *p) {
+	unsigned long long v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static unsigned int read32(const unsigned char *p) {
+	return (unsigned int) p[0] | ((unsigned int) p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned long long round64(unsigned long long acc, unsigned long long input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static unsigned long long merge_round(unsigned long long h, unsigned long long acc) {
+	h ^= round64(0, acc);
+	return h * PRIME64_1 + PRIME64_4;
+}
+
+static void consume_stripe(struct hash_state *state, const unsigned char *p) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		state->h_acc[i] = round64(state->h_acc[i], read64(p + 8 * i));
+	}
+}
+
+void hash_init(struct hash_state *state, unsigned long long seed) {
+	memset(state, 0, sizeof(*state));
+	state->h_seed = seed;
+	state->h_acc[0] = seed + PRIME64_1 + PRIME64_2;
+	state->h_acc[1] = seed + PRIME64_2;
+	state->h_acc[2] = seed;
+	state->h_acc[3] = seed - PRIME64_1;
+}
+
+void hash_update(struct hash_state *state, const void *data, size_t length) {
+	const unsigned char *p = data;
+	state->h_total += length;
+	// top up a partial stripe left by the previous update first
+	if (state->h_buffered > 0) {
+		size_t take = 32 - state->h_buffered;
+		if (take > length) {
+			take = length;
+		}
+		memcpy(state->h_buffer + state->h_buffered, p, take);
+		state->h_buffered += take;
+		p += take;
+		length -= take;
+		if (state->h_buffered < 32) {
+			return;
+		}
+		consume_stripe(state, state->h_buffer);
+		state->h_buffered = 0;
+	}
+	while (length >= 32) {
+		consume_stripe(state, p);
+		p += 32;
+		length -= 32;
+	}
+	memcpy(state->h_buffer, p, length);
+	state->h_buffered = length;
+}
+
+unsigned long long hash_final(struct hash_state *state) {
+	unsigned long long h;
+	if (state->h_total >= 32) {
+		h = rotl64(state->h_acc[0], 1) + rotl64(state->h_acc[1], 7)
+			+ rotl64(state->h_acc[2], 12) + rotl64(state->h_acc[3], 18);
+		int i;
+		for (i = 0; i < 4; i++) {
+			h = merge_round(h, state->h_acc[i]);
+		}
+	} else {
+		h = state->h_seed + PRIME64_5;
+	}
+	h += state->h_total;
+
+	const unsigned char *p = state->h_buffer;
+	unsigned int left = state->h_buffered;
+	while (left >= 8) {
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+		left -= 8;
+	}
+	if (left >= 4) {
+		h ^= (unsigned long long) read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+		left -= 4;
+	}
+	while (left > 0) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p += 1;
+		left -= 1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+unsigned long long hash_buffer(const void *data, size_t length, unsigned long long seed) {
+	struct hash_state state;
+	hash_init(&state, seed);
+	hash_update(&state, data, length);
+	return hash_final(&state);
+}
@@ -0,0 +1,28 @@
+#ifndef EXT2_HASH_H
+#define EXT2_HASH_H
+
+#include <stddef.h>
+
+/*
+ * 64-bit content hash (the XXH64 algorithm) used to recognise identical
+ * file contents. It is fast and well distributed, not cryptographic: equal
+ * hashes are confirmed by comparing the contents before data is shared.
+ *
+ * Data can be hashed in one call with hash_buffer(), or in pieces, such as
+ * the blocks of a file, with hash_init(), hash_update() and hash_final().
+ */
+
+struct hash_state {
+	unsigned long long h_acc[4];     /* Lane accumulators */
+	unsigned long long h_total;      /* Bytes hashed so far */
+	unsigned char h_buffer[32];      /* Bytes not yet forming a full stripe */
+	unsigned int h_buffered;
+	unsigned long long h_seed;
+};
+
+void hash_init(struct hash_state *state, unsigned long long seed);
+void hash_update(struct hash_state *state, const void *data, size_t length);
+unsigned long long hash_final(struct hash_state *state);
+unsigned long long hash_buffer(const void *data, size_t length, unsigned long long seed);
+
+#endif
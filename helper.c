@@ -1,28 +1,190 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "ext2.h"
+#include "helper.h"
+#include "journal.h"
+#include "blockio.h"
+#include "trash.h"
 
-unsigned char *disk;
 struct ext2_group_desc *gd;
 struct ext2_super_block *sb;
+int disk_fd = -1;
+size_t disk_size;
+
+/*
+    Open the image at image_path through the block layer and set up sb and gd.
+    A journal left behind by an interrupted run is rolled back first.
+    Exits on failure. The image is synced and closed automatically at exit.
+ */
+void open_image(char *image_path) {
+    // with an overlay the image itself is the read-only base
+    char *overlay_path = getenv("EXT2_OVERLAY");
+    disk_fd = open(image_path, overlay_path != NULL ? O_RDONLY : O_RDWR);
+    if (disk_fd < 0) {
+        perror("open");
+        exit(1);
+    }
+    struct stat image_stat;
+    if (fstat(disk_fd, &image_stat) < 0) {
+        perror("fstat");
+        exit(1);
+    }
+    disk_size = image_stat.st_size;
+    if (blockio_open(image_path, disk_fd, disk_size) < 0) {
+        perror("open image");
+        exit(1);
+    }
+
+    int restored = journal_open(overlay_path != NULL ? overlay_path : image_path);
+    if (restored < 0) {
+        perror("journal");
+        exit(1);
+    } else if (restored > 0) {
+        fprintf(stderr, "Recovered: rolled back %d block(s) of an unfinished transaction\n", restored);
+    }
+    // superblock and group descriptor are used for the whole run
+    pin_block(1);
+    pin_block(2);
+    sb = (struct ext2_super_block *) get_block(1);
+    gd = (struct ext2_group_desc *) get_block(2);
+    atexit(close_image);
+}
+
+/*
+    Commit any open journal transaction and release the image.
+ */
+void close_image() {
+    if (disk_fd < 0) {
+        return;
+    }
+    journal_close();
+    blockio_close();
+    close(disk_fd);
+    disk_fd = -1;
+}
+
+/*
+    Synchronously write every modified block of the image back to the file.
+ */
+void sync_image() {
+    flush_dirty_blocks(1);
+}
+
+/*
+    Mark the end of one logical operation (one file created, removed, ...).
+    Tools that perform several operations in one run call this after each.
+ */
+void end_operation() {
+    journal_end_operation();
+    blockio_end_operation();
+}
+
+/*
+    Must be called before a metadata block (bitmap, inode table, directory or
+    indirect block, superblock, group descriptor) is modified.
+ */
+void dirty_metadata_block(int block_num) {
+    journal_log_block(block_num);
+    mark_block_dirty(block_num);
+}
+
+/*
+    Must be called before a file data block is written. Data blocks are not
+    journalled, only tracked for flushing.
+ */
+void dirty_data_block(int block_num) {
+    mark_block_dirty(block_num);
+}
+
+/*
+    Must be called before the inode with the given number is modified.
+ */
+void dirty_inode(int inode_num) {
+    dirty_metadata_block(inode_table_block(inode_num));
+}
+
+/*
+    Given inode number, return the number of the inode table block holding it.
+ */
+int inode_table_block(int inode_num) {
+    int inode_offset = (inode_num - 1) * sizeof(struct ext2_inode);
+    return gd->bg_inode_table + inode_offset / EXT2_BLOCK_SIZE;
+}
+
 /*
     Given inode number, return the pointer to an inode struct from the inode table.
  */
 struct ext2_inode *get_inode_pointer(int inode_num){
     int inode_idx = inode_num - 1;
-    struct ext2_inode *inode = (struct ext2_inode *)(disk + (1024 * gd->bg_inode_table) + inode_idx*sizeof(struct ext2_inode));
+    int inode_offset = inode_idx * sizeof(struct ext2_inode);
+    unsigned char *block = get_block(inode_table_block(inode_num));
+    struct ext2_inode *inode = (struct ext2_inode *)(block + inode_offset % EXT2_BLOCK_SIZE);
     return inode;
 }
 /*
     Given block offset and a block index, return the pointer to a dir_entry struct.
  */
 struct ext2_dir_entry *get_dir_entry_pointer(int block_num, int block_offset) {
-    struct ext2_dir_entry *dir_entry = (struct ext2_dir_entry *)(disk + (block_num * EXT2_BLOCK_SIZE) + block_offset);
+    struct ext2_dir_entry *dir_entry = (struct ext2_dir_entry *)(get_block(block_num) + block_offset);
     return dir_entry;
 }
 
+/*
+    Start reading every block of the inode: the direct blocks, the indirect
+    block and the blocks it lists. Used before walking a directory.
+ */
+void prefetch_inode_blocks(struct ext2_inode *inode) {
+    if (inode_is_fast_symlink(inode)) {
+        return;
+    }
+    int block_nums[13];
+    int count = 0;
+    int i;
+    for (i = 0 ; i < 13 ; i++) {
+        if (inode->i_block[i] != 0) {
+            block_nums[count++] = inode->i_block[i];
+        }
+    }
+    prefetch_blocks(block_nums, count);
+
+    int indirect_count = inode->i_blocks / 2 - 13;
+    if (inode->i_block[12] != 0 && indirect_count > 0) {
+        if (indirect_count > EXT2_BLOCK_SIZE / sizeof(int)) {
+            indirect_count = EXT2_BLOCK_SIZE / sizeof(int);
+        }
+        prefetch_blocks((int *) get_block(inode->i_block[12]), indirect_count);
+    }
+}
+
+/*
+    Start reading the inode table blocks of every entry in a directory block.
+ */
+void prefetch_dir_entry_inodes(int block_num) {
+    int block_nums[EXT2_BLOCK_SIZE / 8];
+    int count = 0;
+    int block_offset = 0;
+    while (block_offset < EXT2_BLOCK_SIZE) {
+        struct ext2_dir_entry *dir_entry = get_dir_entry_pointer(block_num, block_offset);
+        if (dir_entry->rec_len == 0) {
+            break;
+        }
+        if (dir_entry->inode != 0) {
+            int inode_offset = (dir_entry->inode - 1) * sizeof(struct ext2_inode);
+            block_nums[count++] = gd->bg_inode_table + inode_offset / EXT2_BLOCK_SIZE;
+        }
+        block_offset += dir_entry->rec_len;
+    }
+    prefetch_blocks(block_nums, count);
+}
+
 /*
     Given inode number and i_block number, return the data block number.
  */
@@ -39,7 +201,7 @@ int get_block_bit_value(int block_num) {
     // Read byte at interest and output the according value
     char mask = 1;
     char block_char;
-    strncpy(&block_char, (char *) (disk + gd->bg_block_bitmap* EXT2_BLOCK_SIZE + sizeof(char) * at_byte), sizeof(char));
+    strncpy(&block_char, (char *) (get_block(gd->bg_block_bitmap) + sizeof(char) * at_byte), sizeof(char));
 
     char bit;
     bit = block_char >> offset;
@@ -56,7 +218,7 @@ int get_inode_bit_value(int inode_num) {
     // Read byte at interest and output the according value
     char mask = 1;
     char inode_char;
-    strncpy(&inode_char, (char *) (disk + gd->bg_inode_bitmap * EXT2_BLOCK_SIZE + sizeof(char) * at_byte), sizeof(char));
+    strncpy(&inode_char, (char *) (get_block(gd->bg_inode_bitmap) + sizeof(char) * at_byte), sizeof(char));
 
     char bit;
     bit = inode_char >> offset;
@@ -64,71 +226,251 @@ int get_inode_bit_value(int inode_num) {
     return bit;
 }
 
-// Modifies the bit at bit_index of block bitmap so that it becomes equivalent to 'value'
-void update_block_bitmap(int block_num, int value) {
-	// Verify that an update is "needed" by checking in bitmap to see if value is already set.
-    if (get_block_bit_value(block_num) == value){
-        // Exit functon now; no change is needed.
-        return;
+/*
+    Set bits [start, end) of bitmap to value: partial bytes at either end are
+    masked, the bytes in between are counted a word at a time and memset.
+    Returns the number of bits that changed.
+ */
+static int set_bit_range(unsigned char *bitmap, int start, int end, int value) {
+    int changed = 0;
+    // leading bits up to the first byte boundary
+    while (start < end && start % 8 != 0) {
+        unsigned char mask = 1 << (start % 8);
+        if (((bitmap[start / 8] & mask) != 0) != value) {
+            bitmap[start / 8] ^= mask;
+            changed += 1;
+        }
+        start += 1;
+    }
+    // whole bytes
+    int first_byte = start / 8;
+    int end_byte = end / 8;
+    if (first_byte < end_byte) {
+        int set_bits = 0;
+        int i = first_byte;
+        for ( ; i + 8 <= end_byte ; i += 8) {
+            unsigned long long word;
+            memcpy(&word, bitmap + i, sizeof(word));
+            set_bits += __builtin_popcountll(word);
+        }
+        for ( ; i < end_byte ; i++) {
+            set_bits += __builtin_popcount(bitmap[i]);
+        }
+        int total = (end_byte - first_byte) * 8;
+        changed += value ? total - set_bits : set_bits;
+        memset(bitmap + first_byte, value ? 0xff : 0, end_byte - first_byte);
+        start = end_byte * 8;
     }
+    // trailing bits
+    while (start < end) {
+        unsigned char mask = 1 << (start % 8);
+        if (((bitmap[start / 8] & mask) != 0) != value) {
+            bitmap[start / 8] ^= mask;
+            changed += 1;
+        }
+        start += 1;
+    }
+    return changed;
+}
 
-    int bit_idx = block_num - 1;
-    
-    // Update both data in superblock and group descriptor first
-    if (value == 0) {
-        gd->bg_free_blocks_count++;
-        sb->s_free_blocks_count++;
-    } else if (value == 1) {
-        gd->bg_free_blocks_count--;
-        sb->s_free_blocks_count--;
-    }
-    // modifiy the bitmap
-    char *bitmap; 
-    bitmap = (char *) (disk + EXT2_BLOCK_SIZE *gd->bg_block_bitmap);
-    int offset = bit_idx % 8;
-
-    char bit_to_modify = bitmap[bit_idx / 8];
-
-    if (value == 1) { 
-        bit_to_modify = bit_to_modify | (1 << offset);
-    } else {
-        bit_to_modify = bit_to_modify & (~(1 << offset));
+/*
+    Set the block bitmap bits of blocks [start, end) to value without
+    touching the free counters. Returns the number of bits that changed, so
+    that callers can adjust the counters once with adjust_free_counts.
+ */
+int set_block_range(int start, int end, int value) {
+    if (start < 1) {
+        start = 1;
     }
-    
-    bitmap[bit_idx / 8] = bit_to_modify;
+    if (end > sb->s_blocks_count + 1) {
+        end = sb->s_blocks_count + 1;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    dirty_metadata_block(gd->bg_block_bitmap);
+    return set_bit_range(get_block(gd->bg_block_bitmap), start - 1, end - 1, value);
+}
+
+/*
+    Inode bitmap counterpart of set_block_range.
+ */
+int set_inode_range(int start, int end, int value) {
+    if (start < 1) {
+        start = 1;
+    }
+    if (end > sb->s_inodes_count + 1) {
+        end = sb->s_inodes_count + 1;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    dirty_metadata_block(gd->bg_inode_bitmap);
+    return set_bit_range(get_block(gd->bg_inode_bitmap), start - 1, end - 1, value);
+}
+
+// Modifies the bit of block_num in the block bitmap so that it becomes equivalent to 'value'
+void update_block_bitmap(int block_num, int value) {
+    int changed = set_block_range(block_num, block_num + 1, value);
+    adjust_free_counts(value ? -changed : changed, 0);
 }
 
 void update_inode_bitmap(int inode_num, int value) {
-	// Verify that an update is "needed" by checking in bitmap to see if value is already set.
-    if (get_inode_bit_value(inode_num) == value){
-        // Exit functon now; no change is needed.
+    int changed = set_inode_range(inode_num, inode_num + 1, value);
+    adjust_free_counts(0, value ? -changed : changed);
+}
+
+/*
+    Set the bits of the given blocks in the block bitmap to value without
+    touching the free counters. Runs of consecutive block numbers are set as
+    one range, so sorted input touches the bitmap the fewest times.
+    Returns the number of bits that changed.
+ */
+int set_block_bits(int *block_nums, int count, int value) {
+    int changed = 0;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && block_nums[i + run] == block_nums[i] + run) {
+            run += 1;
+        }
+        changed += set_block_range(block_nums[i], block_nums[i] + run, value);
+        i += run;
+    }
+    return changed;
+}
+
+/*
+    Inode bitmap counterpart of set_block_bits.
+ */
+int set_inode_bits(int *inode_nums, int count, int value) {
+    int changed = 0;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && inode_nums[i + run] == inode_nums[i] + run) {
+            run += 1;
+        }
+        changed += set_inode_range(inode_nums[i], inode_nums[i] + run, value);
+        i += run;
+    }
+    return changed;
+}
+
+/*
+    Add the given deltas to the free block and inode counters of both the
+    superblock and the group descriptor.
+ */
+void adjust_free_counts(int free_blocks_delta, int free_inodes_delta) {
+    if (free_blocks_delta == 0 && free_inodes_delta == 0) {
         return;
     }
+    dirty_metadata_block(1); // superblock
+    dirty_metadata_block(2); // group descriptor
+    sb->s_free_blocks_count += free_blocks_delta;
+    gd->bg_free_blocks_count += free_blocks_delta;
+    sb->s_free_inodes_count += free_inodes_delta;
+    gd->bg_free_inodes_count += free_inodes_delta;
+}
 
-    int inode_idx = inode_num - 1;
-    // Update both data in superinode and group descriptor first
-    if (value == 0) {
-        gd->bg_free_inodes_count++;
-        sb->s_free_inodes_count++;
-    } else if (value == 1) {
-        gd->bg_free_inodes_count--;
-        sb->s_free_inodes_count--;
-    }
-
-    // Now modifiy the bitmap
-    char *bitmap; 
-    bitmap = (char *) (disk + EXT2_BLOCK_SIZE * gd->bg_inode_bitmap);
-    int offset = inode_idx % 8;
+/*
+    Punch holes in the image file over the given freed blocks, one per run of
+    consecutive block numbers (sorted input gives the largest runs). The
+    freeing is committed and synced first, so a crash can never leave an
+    allocated block with its data punched away.
+    Returns the number of holes punched, or -1 if the host cannot punch holes.
+ */
+int trim_blocks(int *block_nums, int count) {
+    journal_commit();
+    sync_image();
+    int holes = 0;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && block_nums[i + run] == block_nums[i] + run) {
+            run += 1;
+        }
+        if (discard_blocks(block_nums[i], run) != 0) {
+            return -1;
+        }
+        holes += 1;
+        i += run;
+    }
+    return holes;
+}
 
-    char bit_to_modify = bitmap[inode_idx / 8];
-    if (value == 1) { 
-        bit_to_modify = bit_to_modify | (1 << offset);
-    } else {
-        bit_to_modify = bit_to_modify & (~(1 << offset));
+/*
+    Check that blocks_needed blocks and inodes_needed inodes are free,
+    purging the trash to make room if they are not.
+    Returns 1 if there is enough space, 0 otherwise.
+ */
+int ensure_free_space(int blocks_needed, int inodes_needed) {
+    if (gd->bg_free_blocks_count >= blocks_needed && gd->bg_free_inodes_count >= inodes_needed) {
+        return 1;
     }
-    
-    bitmap[inode_idx / 8] = bit_to_modify;
-    
+    trash_purge();
+    return gd->bg_free_blocks_count >= blocks_needed && gd->bg_free_inodes_count >= inodes_needed;
+}
+
+// where the next file starts, so that files written in a row are packed
+static int last_allocated_block;
+
+/*
+    Allocate count free blocks in one pass over the bitmap, taking the first
+    free ones at or after goal (wrapping around) so that they end up close
+    to each other, and update the counters once. The numbers are stored in
+    block_nums. Returns the number allocated, less than count if the image
+    is short of blocks.
+ */
+int allocate_blocks_near(int goal, int count, int *block_nums) {
+    unsigned char *bitmap = get_block(gd->bg_block_bitmap);
+    if (goal < 1 || goal > sb->s_blocks_count) {
+        goal = 1;
+    }
+    int found = 0;
+    int step;
+    for (step = 0 ; step < sb->s_blocks_count && found < count ; step++) {
+        int bit_idx = (goal - 1 + step) % sb->s_blocks_count;
+        // whole bytes of used blocks are skipped at once
+        if (bit_idx % 8 == 0 && bitmap[bit_idx / 8] == 0xff && bit_idx + 8 <= sb->s_blocks_count) {
+            step += 7;
+            continue;
+        }
+        if ((bitmap[bit_idx / 8] & (1 << (bit_idx % 8))) == 0) {
+            block_nums[found++] = bit_idx + 1;
+        }
+    }
+    adjust_free_counts(-set_block_bits(block_nums, found, 1), 0);
+    if (found > 0) {
+        last_allocated_block = block_nums[found - 1];
+    }
+    return found;
+}
+
+/*
+    Find the first count free inodes after the reserved ones, without
+    taking them, and store their numbers in inode_nums. Returns the number
+    found.
+ */
+int find_free_inodes(int count, int *inode_nums) {
+    int found = 0;
+    int inode_num;
+    for (inode_num = EXT2_GOOD_OLD_FIRST_INO + 1 ; inode_num <= sb->s_inodes_count && found < count ; inode_num++) {
+        if (get_inode_bit_value(inode_num) == 0) {
+            inode_nums[found++] = inode_num;
+        }
+    }
+    return found;
+}
+
+/*
+    Inode counterpart of allocate_blocks_near, taking the first free inodes
+    after the reserved ones.
+ */
+int allocate_inodes(int count, int *inode_nums) {
+    int found = find_free_inodes(count, inode_nums);
+    adjust_free_counts(0, -set_inode_bits(inode_nums, found, 1));
+    return found;
 }
 
 /*
@@ -162,6 +504,191 @@ int find_first_available_inode() {
     return -1;
 }
 
+/*
+    A symlink whose target is stored in i_block itself rather than in a data
+    block; its i_block holds no block numbers.
+ */
+int inode_is_fast_symlink(struct ext2_inode *inode) {
+    return find_filetype(inode->i_mode) == 'l' && inode->i_blocks == 0;
+}
+
+/*
+    Store every block used by the inode in block_nums: the direct blocks, the
+    single indirect block and the blocks it lists. A fast symlink has none.
+    block_nums must have room for 13 + EXT2_BLOCK_SIZE / sizeof(int) entries.
+    Returns the number of blocks stored.
+ */
+int collect_inode_blocks(struct ext2_inode *inode, int *block_nums) {
+    int count = 0;
+    int i;
+    if (inode_is_fast_symlink(inode)) {
+        return 0;
+    }
+    for (i = 0 ; i < 12 ; i++) {
+        if (inode->i_block[i] != 0) {
+            block_nums[count++] = inode->i_block[i];
+        }
+    }
+    if (inode->i_block[12] != 0) {
+        block_nums[count++] = inode->i_block[12];
+        int *indirect_blocks = (int *) get_block(inode->i_block[12]);
+        // a sparse file has holes anywhere in the indirect block
+        for (i = 0 ; i < EXT2_BLOCK_SIZE / sizeof(int) ; i++) {
+            if (indirect_blocks[i] != 0) {
+                block_nums[count++] = indirect_blocks[i];
+            }
+        }
+    }
+    return count;
+}
+
+/*
+    Block-map walker shared by the tools that write into existing files.
+    Returns the block holding logical block file_block of the inode, 0 if
+    it is not mapped, or -1 if it lies past the single indirect block or
+    cannot be allocated. With allocate set a missing block (and the indirect
+    block, zeroed) is allocated right after the block mapped before it, so
+    files grow contiguously. The first block of a file goes right after the
+    last block allocated, which packs files written one after the other.
+ */
+int map_file_block(int inode_num, int file_block, int allocate) {
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    if (file_block < 0 || file_block >= MAX_FILE_BLOCKS) {
+        return -1;
+    }
+    int *slot;
+    int slot_block;
+    if (file_block < 12) {
+        slot = (int *) &inode->i_block[file_block];
+        slot_block = -1;
+    } else {
+        if (inode->i_block[12] == 0) {
+            if (!allocate) {
+                return 0;
+            }
+            int indirect_num;
+            if (allocate_blocks_near(inode->i_block[11] + 1, 1, &indirect_num) != 1) {
+                return -1;
+            }
+            dirty_inode(inode_num);
+            dirty_metadata_block(indirect_num);
+            memset(get_block(indirect_num), 0, EXT2_BLOCK_SIZE);
+            inode->i_block[12] = indirect_num;
+            inode->i_blocks += 2;
+        }
+        slot = (int *) get_block(inode->i_block[12]) + (file_block - 12);
+        slot_block = inode->i_block[12];
+    }
+    if (*slot != 0 || !allocate) {
+        return *slot;
+    }
+    int goal = file_block > 0 ? map_file_block(inode_num, file_block - 1, 0) + 1 : last_allocated_block + 1;
+    int block_num;
+    if (allocate_blocks_near(goal, 1, &block_num) != 1) {
+        return -1;
+    }
+    if (slot_block != -1) {
+        dirty_metadata_block(slot_block);
+    }
+    dirty_inode(inode_num);
+    *slot = block_num;
+    inode->i_blocks += 2;
+    return block_num;
+}
+
+/*
+    Read-side counterpart of map_file_block for a range: store the blocks
+    holding logical blocks first_block .. first_block + count - 1 of the
+    inode in block_nums, 0 for a hole. The indirect block is read once, and
+    only if the range reaches it; the mapped blocks are prefetched.
+    Returns the number of blocks stored, fewer than count if the range runs
+    past MAX_FILE_BLOCKS.
+ */
+int map_file_range(int inode_num, int first_block, int count, int *block_nums) {
+    if (count <= 0) {
+        return 0;
+    }
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    int *indirect = NULL;
+    if (first_block + count > 12 && inode->i_block[12] != 0) {
+        indirect = (int *) get_block(inode->i_block[12]);
+    }
+    int mapped = 0;
+    int prefetch_nums[count];
+    int prefetch_count = 0;
+    int file_block;
+    for (file_block = first_block ; file_block < first_block + count && file_block < MAX_FILE_BLOCKS ; file_block++) {
+        int block_num;
+        if (file_block < 12) {
+            block_num = inode->i_block[file_block];
+        } else {
+            block_num = indirect == NULL ? 0 : indirect[file_block - 12];
+        }
+        block_nums[mapped++] = block_num;
+        if (block_num != 0) {
+            prefetch_nums[prefetch_count++] = block_num;
+        }
+    }
+    prefetch_blocks(prefetch_nums, prefetch_count);
+    return mapped;
+}
+
+/*
+    Count the blocks that must be allocated for logical blocks
+    [0, block_count) of the inode to be mapped, indirect block included.
+ */
+int unmapped_blocks(int inode_num, int block_count) {
+    int missing = 0;
+    int file_block;
+    for (file_block = 0 ; file_block < block_count && file_block < MAX_FILE_BLOCKS ; file_block++) {
+        if (map_file_block(inode_num, file_block, 0) == 0) {
+            missing += 1;
+        }
+    }
+    if (block_count > 12 && get_inode_pointer(inode_num)->i_block[12] == 0) {
+        missing += 1;
+    }
+    return missing;
+}
+
+/*
+    Unmap and free every block of the inode from logical block first_block
+    on, and the indirect block once nothing past the direct blocks is left.
+    The blocks are freed together with one counter update.
+    Returns the number of blocks freed.
+ */
+int release_file_blocks(int inode_num, int first_block) {
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    int block_nums[MAX_INODE_BLOCKS];
+    int count = 0;
+    dirty_inode(inode_num);
+    int file_block;
+    for (file_block = first_block ; file_block < 12 ; file_block++) {
+        if (inode->i_block[file_block] != 0) {
+            block_nums[count++] = inode->i_block[file_block];
+            inode->i_block[file_block] = 0;
+        }
+    }
+    if (inode->i_block[12] != 0) {
+        dirty_metadata_block(inode->i_block[12]);
+        int *sib = (int *) get_block(inode->i_block[12]);
+        for (file_block = (first_block > 12 ? first_block : 12) ; file_block < MAX_FILE_BLOCKS ; file_block++) {
+            if (sib[file_block - 12] != 0) {
+                block_nums[count++] = sib[file_block - 12];
+                sib[file_block - 12] = 0;
+            }
+        }
+        if (first_block <= 12) {
+            block_nums[count++] = inode->i_block[12];
+            inode->i_block[12] = 0;
+        }
+    }
+    inode->i_blocks -= 2 * count;
+    qsort(block_nums, count, sizeof(int), compare_numbers);
+    adjust_free_counts(set_block_bits(block_nums, count, 0), 0);
+    return count;
+}
+
 /*
     Given an i_mode found in the inode struct, return the type of file.
  */
@@ -190,6 +717,7 @@ char find_filetype(unsigned short i_mode) {
  */
 int find_token_in_dir(int inode_num, char *token) {
     struct ext2_inode *inode = get_inode_pointer(inode_num);
+    prefetch_inode_blocks(inode);
     // inode must be of directory type
     int i;
     for (i = 0 ; i < inode->i_blocks / 2 ; i++) {
@@ -198,7 +726,8 @@ int find_token_in_dir(int inode_num, char *token) {
         while (block_offset < EXT2_BLOCK_SIZE) {
             struct ext2_dir_entry *dir_entry = get_dir_entry_pointer(inode->i_block[i], block_offset);
             // if token is found, update inode_index to search for the next token in the path
-            if (strncmp(dir_entry->name, token, dir_entry->name_len) == 0) {
+            if (dir_entry->name_len == strlen(token)
+                && strncmp(dir_entry->name, token, dir_entry->name_len) == 0) {
                 //inode_index = i_block_index;
                 return dir_entry->inode;
             }
@@ -257,7 +786,7 @@ int get_parent_inode_num_from_path(char *path, int last_slash_offset) {
         } else if (path[i] == '/' && repeated_slash == 0) {
             char name[i - slash_idx];
             strncpy(name, path + slash_idx + 1, i - slash_idx - 1);
-            name[i - slash_idx] = '\0';
+            name[i - slash_idx - 1] = '\0';
 
             struct ext2_inode *inode = get_inode_pointer(inode_num);
             if (find_filetype(inode->i_mode) != 'd') {
@@ -273,11 +802,45 @@ int get_parent_inode_num_from_path(char *path, int last_slash_offset) {
     return inode_num;
 }
 
+/*
+    Walk path from the directory dir_num one component at a time. Empty and
+    "." components are skipped, ".." goes to the parent, and a leading '/'
+    is ignored, so an absolute path is looked up with dir_num EXT2_ROOT_INO.
+    Returns the inode number the path names, or -1 if a component does not
+    exist or a component before the last is not a directory.
+ */
+int lookup_path(int dir_num, char *path) {
+    int inode_num = dir_num;
+    char *component = path;
+    while (*component != '\0') {
+        char *slash = strchr(component, '/');
+        int length = slash == NULL ? strlen(component) : slash - component;
+        if (length > 0 && !(length == 1 && component[0] == '.')) {
+            if (find_filetype(get_inode_pointer(inode_num)->i_mode) != 'd') {
+                return -1;
+            }
+            char name[length + 1];
+            memcpy(name, component, length);
+            name[length] = '\0';
+            inode_num = find_token_in_dir(inode_num, name);
+            if (inode_num == -1) {
+                return -1;
+            }
+        }
+        component += length;
+        if (*component == '/') {
+            component += 1;
+        }
+    }
+    return inode_num;
+}
+
 /*
     Create a new inode with the given inode number and file type.
     Returns the pointer to the newly created inode struct.
  */
 struct ext2_inode *make_inode(int inode_num, char type) {
+    dirty_inode(inode_num);
     struct ext2_inode *inode = get_inode_pointer(inode_num);
     // set inode type
     if (type == 'd') {
@@ -360,23 +923,44 @@ int first_available_i_block(int inode_num, int name_len) {
 int inode_needs_new_block_for_new_dir_entry(int inode_num, int name_len) {
     int i_block_idx = first_available_i_block(inode_num, name_len);
     struct ext2_inode* inode = get_inode_pointer(inode_num);
-    if (inode->i_block[i_block_idx] == 0) {
+    if (i_block_idx == -1 || inode->i_block[i_block_idx] == 0) {
         return 1;
     }
     return 0;
 }
 
-void make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char type) {
+/*
+    Add the entry entry_name for the inode entry_num to the directory dir_num,
+    growing the directory by a block if none has room for it.
+    Returns 0 on success, ENOSPC if the directory or the image is full.
+ */
+int make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char type) {
     struct ext2_inode *dir = get_inode_pointer(dir_num);
     int i_block_idx = first_available_i_block(dir_num, strlen(entry_name));
+    if (i_block_idx == -1) {
+        return ENOSPC;
+    }
 
     // the starting position in the block at which the new_entry will be placed
     int new_entry_offset;
     if (dir->i_block[i_block_idx] == 0) {
-        dir->i_block[i_block_idx] = find_first_available_block();
+        int block_num = find_first_available_block();
+        if (block_num == -1) {
+            return ENOSPC;
+        }
+        dirty_inode(dir_num);
+        dir->i_block[i_block_idx] = block_num;
         dir->i_blocks += 2;
+        if (dir->i_size < (i_block_idx + 1) * EXT2_BLOCK_SIZE) {
+            dir->i_size = (i_block_idx + 1) * EXT2_BLOCK_SIZE;
+        }
         new_entry_offset = 0;
+        dirty_metadata_block(dir->i_block[i_block_idx]);
+        // the block may have held data: names are padded with zeroes
+        memset(get_block(dir->i_block[i_block_idx]), 0, EXT2_BLOCK_SIZE);
     } else {
+        dirty_inode(dir_num);
+        dirty_metadata_block(dir->i_block[i_block_idx]);
         // find the last dir_entry in existing block and update its rec_len
         int last_offset = find_offset_of_last_dir_entry(dir->i_block[i_block_idx]);
         struct ext2_dir_entry *last_entry = get_dir_entry_pointer(dir->i_block[i_block_idx], last_offset);
@@ -386,6 +970,7 @@ void make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char
     }
 
     // increase the link_count for the inode that the new_dir_entry points to
+    dirty_inode(entry_num);
     struct ext2_inode *target_inode = get_inode_pointer(entry_num);
     target_inode->i_links_count += 1;
 
@@ -405,8 +990,390 @@ void make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char
     } else {
         new_entry->file_type = EXT2_FT_UNKNOWN;
     }
+    return 0;
+}
+
+
+// qsort comparator for block and inode numbers
+int compare_numbers(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
 }
 
+// Removes the ext2_dir_entry victim_entry with respect to the entry that comes 
+// before it, last_entry
+// Returns the index of the inode that contains the removed item
+int remove_dir_entry(struct ext2_dir_entry *victim_entry,
+                     struct ext2_dir_entry *last_entry,
+                     struct ext2_inode *parent_inode,
+                     int i_block_index) {
+
+    int victim_inode_index = victim_entry->inode;
+    struct ext2_inode *victim_inode = get_inode_pointer(victim_inode_index);
+
+    // RMB: decrement i_links_count for victim_inode!
+
+    // Few things to check (in order) : 
+    // -    if this file takes up the entire block, 
+    //         then the block should be unset & disabled and information to be updated to
+    //         bitmap.
+    // -    If the victim_inode just happens to be the first one in block: set its inode
+    //         to 0 to invalidate
+    //        
+
+    if (victim_entry->rec_len == EXT2_BLOCK_SIZE){
+        // Empty this block
+        update_block_bitmap(parent_inode->i_block[i_block_index], 0);
+        parent_inode->i_block[i_block_index] = 0;
+        parent_inode->i_blocks -= 2;
+
+    } else if (last_entry == NULL) {
+        // Set inode to 0 to invalidate
+        victim_entry->inode = 0;
+
+    } else {
+        last_entry->rec_len+= victim_entry->rec_len;
+    }
+
+    victim_inode->i_links_count--;
+    return victim_inode_index;
+
+}
+
+// Function that removes the file entry with name "victim_name" from parent_inode_num
+// Returns the index of the inode the removed entry referred to, or -1 if not found
+int remove_victim_at_inode(int parent_inode_num, char* victim_name){
+
+    // Things to do to garentee removal:
+    //    -    Traverse though the i_block of the parent block, once vimtim is found:
+    //            -    Get victim inode
+    //            -    Use victim's inode to find the block that's associated with it
+    //            -    Remove block
+    //            -    Decrease hard link count in inode as blocks have been decreased
+    //            -    Update the rec_len count for the dir before victim
+
+    struct ext2_inode *parent_inode = get_inode_pointer(parent_inode_num);
+
+    int i;
+    for (i=0; i<(parent_inode->i_blocks)/2; i++){
+        struct ext2_dir_entry *current_entry = get_dir_entry_pointer(parent_inode->i_block[i], 0);
+        struct ext2_dir_entry *last_entry = NULL; // This will become userful in later steps
+
+        // Traverse though this entire block
+        int offset = 0;
+        while (offset < EXT2_BLOCK_SIZE) {
+
+            // Check if this dir_entry happens to be the target: the victim to be removed
+            if (current_entry->name_len == strlen(victim_name)
+                && strncmp(victim_name, current_entry->name, current_entry->name_len) == 0) {
+
+                dirty_inode(parent_inode_num);
+                dirty_metadata_block(parent_inode->i_block[i]);
+                dirty_inode(current_entry->inode);
+                return remove_dir_entry(current_entry, last_entry, parent_inode, i);
+            }
+
+            // Update last and curr_dir_entry
+            offset += current_entry->rec_len;
+            last_entry = current_entry;
+            current_entry = get_dir_entry_pointer(parent_inode->i_block[i], offset);
+        }
+    }
+    return -1;
+}
+
+void add_to_release_list(struct release_list *list, int num) {
+    if (list->count == list->space) {
+        list->space = list->space ? list->space * 2 : 64;
+        list->nums = realloc(list->nums, list->space * sizeof(int));
+    }
+    list->nums[list->count++] = num;
+}
+
+// Marks inode_num deleted and puts it and its blocks on the release lists;
+// the bitmaps are left alone until free_released_lists.
+void release_inode(int inode_num, struct release_list *inodes, struct release_list *blocks) {
+    struct ext2_inode *inode = get_inode_pointer(inode_num);
+    dirty_inode(inode_num);
+    int block_nums[MAX_INODE_BLOCKS];
+    int count = collect_inode_blocks(inode, block_nums);
+    int i;
+    for (i = 0; i < count; i++) {
+        add_to_release_list(blocks, block_nums[i]);
+    }
+    add_to_release_list(inodes, inode_num);
+    inode->i_links_count = 0;
+    inode->i_dtime = (unsigned int) time(NULL);
+}
+
+// Clears every released block and inode in the bitmaps, in ascending order,
+// and updates the free counters once.
+void free_released_lists(struct release_list *inodes, struct release_list *blocks, int dirs) {
+    qsort(blocks->nums, blocks->count, sizeof(int), compare_numbers);
+    qsort(inodes->nums, inodes->count, sizeof(int), compare_numbers);
+    int freed_blocks = set_block_bits(blocks->nums, blocks->count, 0);
+    int freed_inodes = set_inode_bits(inodes->nums, inodes->count, 0);
+    adjust_free_counts(freed_blocks, freed_inodes);
+    dirty_metadata_block(2);
+    gd->bg_used_dirs_count -= dirs;
+}
+
+// Drops the links of the entries of directory dir_num. Subdirectories are
+// pushed onto dir_stack; files whose last link goes away are released. The
+// position (block_num * EXT2_BLOCK_SIZE + offset) of the entry of a file
+// that is still linked is added to kept_links: whether the other links are
+// outside the tree is only known once the whole tree has been walked.
+void unlink_dir_entries(int dir_num, struct release_list *dir_stack, struct release_list *kept_links,
+                        struct release_list *inodes, struct release_list *blocks) {
+    struct ext2_inode *dir = get_inode_pointer(dir_num);
+    prefetch_dir_entry_inodes(dir_num);
+    int i;
+    for (i = 0; i < 12; i++) {
+        int block_num = dir->i_block[i];
+        if (block_num == 0) {
+            continue;
+        }
+        int offset = 0;
+        while (offset < EXT2_BLOCK_SIZE) {
+            struct ext2_dir_entry *entry = get_dir_entry_pointer(block_num, offset);
+            if (entry->rec_len == 0) {
+                break;
+            }
+            int position = block_num * EXT2_BLOCK_SIZE + offset;
+            offset += entry->rec_len;
+            int is_dot = (entry->name_len == 1 && entry->name[0] == '.')
+                || (entry->name_len == 2 && strncmp(entry->name, "..", 2) == 0);
+            if (is_dot || entry->inode == 0) {
+                continue;
+            }
+            struct ext2_inode *child = get_inode_pointer(entry->inode);
+            if (find_filetype(child->i_mode) == 'd') {
+                add_to_release_list(dir_stack, entry->inode);
+                continue;
+            }
+            dirty_inode(entry->inode);
+            child->i_links_count--;
+            if (child->i_links_count == 0) {
+                release_inode(entry->inode, inodes, blocks);
+                continue;
+            }
+            add_to_release_list(kept_links, position);
+        }
+    }
+}
+
+// Removes the entries at the positions in kept_links whose file is still
+// linked from outside the released tree: those links are really gone. An
+// entry whose file lost its last link further on in the tree stays readable
+// with the others, so that ext2_restore -r brings back every name.
+static void remove_outside_links(struct release_list *kept_links) {
+    int i;
+    // last first, so that an entry is merged before the one it follows
+    for (i = kept_links->count - 1; i >= 0; i--) {
+        int block_num = kept_links->nums[i] / EXT2_BLOCK_SIZE;
+        int victim_offset = kept_links->nums[i] % EXT2_BLOCK_SIZE;
+        struct ext2_dir_entry *victim = get_dir_entry_pointer(block_num, victim_offset);
+        if (get_inode_pointer(victim->inode)->i_links_count == 0) {
+            continue;
+        }
+        dirty_metadata_block(block_num);
+        if (victim_offset == 0) {
+            victim->inode = 0;
+            continue;
+        }
+        int offset = 0;
+        struct ext2_dir_entry *last_entry = get_dir_entry_pointer(block_num, 0);
+        while (last_entry->rec_len > 0 && offset + last_entry->rec_len < victim_offset) {
+            offset += last_entry->rec_len;
+            last_entry = get_dir_entry_pointer(block_num, offset);
+        }
+        last_entry->rec_len += victim->rec_len;
+    }
+}
+
+// Releases the directory dir_num and everything below it onto the release
+// lists. Directories are walked with an explicit stack and released in
+// post-order (children before their parents). Cached blocks are released
+// between directories, so callers must not hold unpinned block pointers
+// across the call.
+// Returns the number of directories released.
+int release_tree(int dir_num, struct release_list *inodes, struct release_list *blocks) {
+    struct release_list dir_stack = {NULL, 0, 0};
+    struct release_list visited = {NULL, 0, 0};
+    struct release_list kept_links = {NULL, 0, 0};
+    add_to_release_list(&dir_stack, dir_num);
+    while (dir_stack.count > 0) {
+        // the walk is one operation: keep the cache to its size as it goes
+        release_cached_blocks();
+        int current = dir_stack.nums[--dir_stack.count];
+        add_to_release_list(&visited, current);
+        unlink_dir_entries(current, &dir_stack, &kept_links, inodes, blocks);
+    }
+    remove_outside_links(&kept_links);
+    int i;
+    for (i = visited.count - 1; i >= 0; i--) {
+        release_inode(visited.nums[i], inodes, blocks);
+    }
+    free(dir_stack.nums);
+    free(visited.nums);
+    free(kept_links.nums);
+    return visited.count;
+}
+
+/*
+    Check that blocks data blocks are free and that the directory
+    parent_inode_num can take the entry new_name.
+    Returns 0, or ENOSPC.
+ */
+static int check_room_for_entry(int parent_inode_num, char *new_name, int blocks) {
+    if (first_available_i_block(parent_inode_num, strlen(new_name)) == -1) {
+        return ENOSPC;
+    }
+    blocks += inode_needs_new_block_for_new_dir_entry(parent_inode_num, strlen(new_name));
+    if (gd->bg_free_blocks_count < blocks) {
+        return ENOSPC;
+    }
+    return 0;
+}
+
+/*
+    Make directory in the inode specified by the given inode number.
+    Returns 0, or ENOSPC before anything is changed if there is no room
+    for it; the inode is then left to the caller.
+ */ 
+int make_directory(int parent_inode_num, char *new_name, int new_inode_num) {
+    if (check_room_for_entry(parent_inode_num, new_name, 1) != 0) {
+        return ENOSPC;
+    }
+    // create an inode for the new directory
+    make_inode(new_inode_num, 'd');
+
+    // make "." dir_entry into new_inode
+    make_dir_entry_in_inode(new_inode_num, ".", new_inode_num, 'd');
+    // make ".." dir_entry into new_inode
+    make_dir_entry_in_inode(new_inode_num, "..", parent_inode_num, 'd');
+    
+    // make the dir_entry of this new directory in the parent directory
+    make_dir_entry_in_inode(parent_inode_num, new_name, new_inode_num, 'd');
+    
+    // update number of used directories to include the new directory
+    dirty_metadata_block(2);
+    gd->bg_used_dirs_count += 1;
+    return 0;
+}
+
+/*
+    Create a symlink to target named new_name in the directory parent_inode_num,
+    using the free inode new_inode_num. A target shorter than
+    EXT2_FAST_SYMLINK_MAX is stored in i_block, a longer one in a data block.
+    Returns 0, or ENOSPC before anything is changed if there is no room.
+ */
+int make_symlink(int parent_inode_num, char *new_name, char *target, int new_inode_num) {
+    if (check_room_for_entry(parent_inode_num, new_name, strlen(target) >= EXT2_FAST_SYMLINK_MAX) != 0) {
+        return ENOSPC;
+    }
+    struct ext2_inode *symlink = make_inode(new_inode_num, 's');
+    symlink->i_size = strlen(target);
+    if (strlen(target) < EXT2_FAST_SYMLINK_MAX) {
+        // fast symlink: the target fits in i_block, no data block is used
+        memcpy(symlink->i_block, target, strlen(target));
+    } else {
+        // allocate block and put it in symlink inode
+        int symlink_block_num = find_first_available_block();
+        symlink->i_block[0] = symlink_block_num;
+        symlink->i_blocks += 2;
+        // put data into symlink_block
+        dirty_data_block(symlink_block_num);
+        char *symlink_block = (char *) get_block(symlink_block_num);
+        memset(symlink_block, 0, EXT2_BLOCK_SIZE);
+        memcpy(symlink_block, target, strlen(target));
+    }
+    // this helper updates the symlink inode i_link_count automatically
+    return make_dir_entry_in_inode(parent_inode_num, new_name, new_inode_num, 's');
+}
+
+/*
+    Point the ".." entry of directory dir_num at new_parent and move the link
+    it represents from old_parent.
+ */
+void reparent_directory(int dir_num, int old_parent, int new_parent) {
+    struct ext2_inode *dir = get_inode_pointer(dir_num);
+    int offset = 0;
+    while (offset < EXT2_BLOCK_SIZE) {
+        struct ext2_dir_entry *entry = get_dir_entry_pointer(dir->i_block[0], offset);
+        if (entry->rec_len == 0) {
+            break;
+        }
+        if (entry->name_len == 2 && strncmp(entry->name, "..", 2) == 0) {
+            dirty_metadata_block(dir->i_block[0]);
+            entry->inode = new_parent;
+            break;
+        }
+        offset += entry->rec_len;
+    }
+    dirty_inode(old_parent);
+    get_inode_pointer(old_parent)->i_links_count--;
+    dirty_inode(new_parent);
+    get_inode_pointer(new_parent)->i_links_count++;
+}
+
+/*
+    Copy inode inode_num into inode, reading its inode table block with
+    read_block_shared, so that threads walking the image in parallel can
+    call it.
+ */
+void read_inode_shared(int inode_num, struct ext2_inode *inode) {
+    unsigned char buffer[EXT2_BLOCK_SIZE];
+    int inode_offset = (inode_num - 1) * sizeof(struct ext2_inode);
+    const unsigned char *block = read_block_shared(gd->bg_inode_table + inode_offset / EXT2_BLOCK_SIZE, buffer);
+    memcpy(inode, block + inode_offset % EXT2_BLOCK_SIZE, sizeof(struct ext2_inode));
+}
+
+/*
+    Start walking the entries of the directory dir_num. The cursor keeps a
+    copy of the inode and reads the directory's blocks into its own buffer
+    with read_block_shared, so cursors in different threads do not
+    interfere.
+ */
+void open_dir_cursor(struct dir_cursor *cursor, int dir_num) {
+    read_inode_shared(dir_num, &cursor->dir);
+    cursor->block_idx = -1;
+    cursor->offset = EXT2_BLOCK_SIZE;
+    cursor->block = NULL;
+}
+
+/*
+    Returns the next entry of the cursor's directory in directory order,
+    skipping unused entries, "." and "..", or NULL after the last. The
+    entry is valid until the next call.
+ */
+struct ext2_dir_entry *next_dir_entry(struct dir_cursor *cursor) {
+    while (1) {
+        if (cursor->offset >= EXT2_BLOCK_SIZE) {
+            cursor->block_idx += 1;
+            if (cursor->block_idx >= 12 || cursor->dir.i_block[cursor->block_idx] == 0) {
+                return NULL;
+            }
+            cursor->block = read_block_shared(cursor->dir.i_block[cursor->block_idx], cursor->buffer);
+            cursor->offset = 0;
+            if (cursor->block == NULL) {
+                return NULL;
+            }
+        }
+        struct ext2_dir_entry *entry = (struct ext2_dir_entry *) (cursor->block + cursor->offset);
+        if (entry->rec_len < 8 || cursor->offset + entry->rec_len > EXT2_BLOCK_SIZE) {
+            // a damaged block: go on with the next one
+            cursor->offset = EXT2_BLOCK_SIZE;
+            continue;
+        }
+        cursor->offset += entry->rec_len;
+        if (entry->inode == 0
+            || (entry->name_len == 1 && entry->name[0] == '.')
+            || (entry->name_len == 2 && entry->name[0] == '.' && entry->name[1] == '.')) {
+            continue;
+        }
+        return entry;
+    }
+}
 
 int free_inode_count_from_bitmap() {
     int i;
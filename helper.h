@@ -1,11 +1,25 @@
+#include <stddef.h>
 #include "ext2.h"
+#include "blockio.h"
 
-extern unsigned char *disk;
 extern struct ext2_group_desc *gd;
 extern struct ext2_super_block *sb;
+extern int disk_fd;
+extern size_t disk_size;
 
+void open_image(char *image_path);
+void close_image();
+void sync_image();
+void end_operation();
+void dirty_metadata_block(int block_num);
+void dirty_data_block(int block_num);
+void dirty_inode(int inode_num);
+
+int inode_table_block(int inode_num);
 struct ext2_inode *get_inode_pointer(int inode_num);
 struct ext2_dir_entry *get_dir_entry_pointer(int block_num, int block_offset);
+void prefetch_inode_blocks(struct ext2_inode *inode);
+void prefetch_dir_entry_inodes(int block_num);
 int get_block_number(int inode_num, int i_block_idx);
 
 int get_block_bit_value(int block_num);
@@ -13,10 +27,31 @@ int get_inode_bit_value(int inode_num);
 void update_block_bitmap(int block_num, int value);
 void update_inode_bitmap(int inode_num, int value);
 
+int set_block_range(int start, int end, int value);
+int set_inode_range(int start, int end, int value);
+int set_block_bits(int *block_nums, int count, int value);
+int set_inode_bits(int *inode_nums, int count, int value);
+void adjust_free_counts(int free_blocks_delta, int free_inodes_delta);
+int trim_blocks(int *block_nums, int count);
+
+int ensure_free_space(int blocks_needed, int inodes_needed);
+int allocate_blocks_near(int goal, int count, int *block_nums);
+int find_free_inodes(int count, int *inode_nums);
+int allocate_inodes(int count, int *inode_nums);
 int find_first_available_block();
 int find_first_available_inode();
 int first_available_i_block(int inode_num, int name_len);
 
+#define EXT2_FAST_SYMLINK_MAX (15 * sizeof(int))  /* targets shorter than this live in i_block */
+int inode_is_fast_symlink(struct ext2_inode *inode);
+#define MAX_INODE_BLOCKS (13 + EXT2_BLOCK_SIZE / sizeof(int))
+#define MAX_FILE_BLOCKS (12 + EXT2_BLOCK_SIZE / sizeof(int))  /* data blocks reachable without double indirection */
+int map_file_block(int inode_num, int file_block, int allocate);
+int map_file_range(int inode_num, int first_block, int count, int *block_nums);
+int unmapped_blocks(int inode_num, int block_count);
+int release_file_blocks(int inode_num, int first_block);
+int collect_inode_blocks(struct ext2_inode *inode, int *block_nums);
+
 char find_filetype(unsigned short i_mode);
 
 int find_token_in_dir(int inode_num, char *token);
@@ -25,13 +60,48 @@ int verify_absolute_path_structure(char *path);
 void remove_trailing_slashes(char *path);
 int get_basename_offset(char *path);
 int get_parent_inode_num_from_path(char *path, int last_slash_offset);
+int lookup_path(int dir_num, char *path);
 
 struct ext2_inode *make_inode(int inode_num, char type);
 int compute_rec_len(int name_len);
 int find_offset_of_last_dir_entry(int block_num);
 
 int inode_needs_new_block_for_new_dir_entry(int inode_num, int name_len);
-void make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char type);
+int make_dir_entry_in_inode(int dir_num, char *entry_name, int entry_num, char type);
+int make_directory(int parent_inode_num, char *new_name, int new_inode_num);
+int make_symlink(int parent_inode_num, char *new_name, char *target, int new_inode_num);
+void reparent_directory(int dir_num, int old_parent, int new_parent);
+
+// Inode or block numbers released together, freed at once by free_released_lists
+struct release_list {
+    int *nums;
+    int count;
+    int space;
+};
+
+int compare_numbers(const void *a, const void *b);
+int remove_dir_entry(struct ext2_dir_entry *victim_entry, struct ext2_dir_entry *last_entry,
+                     struct ext2_inode *parent_inode, int i_block_index);
+int remove_victim_at_inode(int parent_inode_num, char *victim_name);
+void add_to_release_list(struct release_list *list, int num);
+void release_inode(int inode_num, struct release_list *inodes, struct release_list *blocks);
+void free_released_lists(struct release_list *inodes, struct release_list *blocks, int dirs);
+void unlink_dir_entries(int dir_num, struct release_list *dir_stack, struct release_list *kept_links,
+                        struct release_list *inodes, struct release_list *blocks);
+int release_tree(int dir_num, struct release_list *inodes, struct release_list *blocks);
+
+// Walks a directory's entries from any thread, see open_dir_cursor
+struct dir_cursor {
+    struct ext2_inode dir;
+    int block_idx;
+    int offset;
+    const unsigned char *block;
+    unsigned char buffer[EXT2_BLOCK_SIZE];
+};
+
+void read_inode_shared(int inode_num, struct ext2_inode *inode);
+void open_dir_cursor(struct dir_cursor *cursor, int dir_num);
+struct ext2_dir_entry *next_dir_entry(struct dir_cursor *cursor);
 
 int free_inode_count_from_bitmap();
 int free_block_count_from_bitmap();
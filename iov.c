@@ -0,0 +1,61 @@
+#include <errno.h>
+#include <unistd.h>
+#include "iov.h"
+
+void iov_writer_init(struct iov_writer *writer, int fd) {
+	writer->w_fd = fd;
+	writer->w_count = 0;
+}
+
+/*
+    Queue length bytes at data, flushing first when every slot is taken.
+    Returns 0, or -1 if a write fails.
+ */
+int iov_queue(struct iov_writer *writer, void *data, size_t length) {
+	if (length == 0) {
+		return 0;
+	}
+	if (writer->w_count > 0) {
+		struct iovec *last = &writer->w_iov[writer->w_count - 1];
+		if ((char *) last->iov_base + last->iov_len == data) {
+			last->iov_len += length;
+			return 0;
+		}
+	}
+	if (writer->w_count == IOV_WRITER_MAX && iov_flush(writer) != 0) {
+		return -1;
+	}
+	writer->w_iov[writer->w_count].iov_base = data;
+	writer->w_iov[writer->w_count].iov_len = length;
+	writer->w_count += 1;
+	return 0;
+}
+
+/*
+    Write out everything queued, resuming after partial writes as a pipe
+    may take less than offered. Returns 0, or -1 if a write fails.
+ */
+int iov_flush(struct iov_writer *writer) {
+	struct iovec *iov = writer->w_iov;
+	int count = writer->w_count;
+	writer->w_count = 0;
+	while (count > 0) {
+		ssize_t written = writev(writer->w_fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov += 1;
+			count -= 1;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef EXT2_IOV_H
+#define EXT2_IOV_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * Gathers pieces of output, typically pointers straight into the block
+ * layer, and writes them with writev. A piece that starts where the
+ * previous one ends in memory extends it, so a run of blocks that are
+ * adjacent in the mapping goes out as one piece without being copied.
+ * Queued pointers must stay valid until the next flush.
+ */
+
+#define IOV_WRITER_MAX 1024  /* Linux UIO_MAXIOV */
+
+struct iov_writer {
+	int w_fd;
+	int w_count;
+	struct iovec w_iov[IOV_WRITER_MAX];
+};
+
+void iov_writer_init(struct iov_writer *writer, int fd);
+int iov_queue(struct iov_writer *writer, void *data, size_t length);
+int iov_flush(struct iov_writer *writer);
+
+#endif
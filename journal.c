@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "ext2.h"
+#include "helper.h"
+#include "journal.h"
+
+static int journal_fd = -1;
+static unsigned int journal_sequence;
+static off_t journal_offset;
+// one bit per image block: set once the block's old contents are in the log
+static unsigned char *logged_blocks;
+static size_t logged_blocks_size;
+static int logged_count;
+static int ops_in_transaction;
+static int ops_per_commit = 1;
+
+static unsigned int journal_checksum(unsigned int block_num, unsigned char *data) {
+	// FNV-1a over the block number and the block contents
+	unsigned int hash = 2166136261u;
+	int i;
+	for (i = 0; i < 4; i++) {
+		hash ^= (block_num >> (i * 8)) & 0xff;
+		hash *= 16777619u;
+	}
+	for (i = 0; i < EXT2_BLOCK_SIZE; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int write_journal_header() {
+	struct journal_header header;
+	memset(&header, 0, sizeof(header));
+	header.j_magic = JOURNAL_MAGIC;
+	header.j_sequence = journal_sequence;
+	header.j_block_size = EXT2_BLOCK_SIZE;
+	if (pwrite(journal_fd, &header, sizeof(header), 0) != sizeof(header)) {
+		return -1;
+	}
+	return fdatasync(journal_fd);
+}
+
+// Write back every valid record of the current sequence to the image.
+// Returns the number of blocks restored.
+static int journal_recover() {
+	struct journal_header header;
+	if (pread(journal_fd, &header, sizeof(header), 0) != sizeof(header)
+		|| header.j_magic != JOURNAL_MAGIC || header.j_block_size != EXT2_BLOCK_SIZE) {
+		// empty or foreign sidecar: nothing can be replayed
+		journal_sequence = 1;
+		return 0;
+	}
+	journal_sequence = header.j_sequence;
+
+	int restored = 0;
+	off_t offset = sizeof(header);
+	struct journal_record record;
+	unsigned char data[EXT2_BLOCK_SIZE];
+	while (pread(journal_fd, &record, sizeof(record), offset) == sizeof(record)) {
+		if (record.r_magic != JOURNAL_RECORD_MAGIC || record.r_sequence != journal_sequence) {
+			break;
+		}
+		// a torn record was never synced, so its block was never modified
+		if (pread(journal_fd, data, EXT2_BLOCK_SIZE, offset + sizeof(record)) != EXT2_BLOCK_SIZE
+			|| journal_checksum(record.r_block_num, data) != record.r_checksum) {
+			break;
+		}
+		unsigned char *block = get_block(record.r_block_num);
+		if (block != NULL) {
+			mark_block_dirty(record.r_block_num);
+			memcpy(block, data, EXT2_BLOCK_SIZE);
+			restored += 1;
+		}
+		offset += sizeof(record) + EXT2_BLOCK_SIZE;
+	}
+	if (restored > 0) {
+		flush_dirty_blocks(1);
+	}
+	// the replayed transaction is finished: start a fresh one
+	journal_sequence += 1;
+	write_journal_header();
+	ftruncate(journal_fd, sizeof(header));
+	return restored;
+}
+
+/*
+    Recover a leftover journal for the image and, if EXT2_JOURNAL is set, keep
+    it open for logging. Must be called once the block layer is open, before
+    anything else reads the image.
+    Returns the number of blocks rolled back, or -1 if the journal could not be opened.
+ */
+int journal_open(char *image_path) {
+	char journal_path[strlen(image_path) + strlen(".journal") + 1];
+	strcpy(journal_path, image_path);
+	strcat(journal_path, ".journal");
+
+	char *enabled = getenv("EXT2_JOURNAL");
+	int use_journal = (enabled != NULL && strcmp(enabled, "0") != 0);
+	char *batch = getenv("EXT2_JOURNAL_BATCH");
+	if (batch != NULL && atoi(batch) > 0) {
+		ops_per_commit = atoi(batch);
+	}
+
+	int restored = 0;
+	journal_fd = open(journal_path, O_RDWR);
+	if (journal_fd >= 0) {
+		restored = journal_recover();
+		if (!use_journal) {
+			close(journal_fd);
+			journal_fd = -1;
+			unlink(journal_path);
+		}
+	} else if (use_journal) {
+		journal_fd = open(journal_path, O_RDWR | O_CREAT, 0644);
+		if (journal_fd < 0) {
+			return -1;
+		}
+		journal_sequence = 1;
+		if (write_journal_header() != 0) {
+			return -1;
+		}
+	}
+	if (journal_fd < 0) {
+		return restored;
+	}
+
+	logged_blocks_size = disk_size / EXT2_BLOCK_SIZE / 8 + 1;
+	logged_blocks = calloc(logged_blocks_size, 1);
+	journal_offset = sizeof(struct journal_header);
+	logged_count = 0;
+	ops_in_transaction = 0;
+	return restored;
+}
+
+/*
+    Log the current contents of block_num unless it is already in the
+    running transaction. Must be called before the block is modified.
+ */
+void journal_log_block(int block_num) {
+	if (journal_fd < 0 || block_num <= 0 || (size_t) block_num / 8 >= logged_blocks_size) {
+		return;
+	}
+	if (logged_blocks[block_num / 8] & (1 << (block_num % 8))) {
+		return;
+	}
+	unsigned char *data = get_block(block_num);
+
+	struct journal_record record;
+	record.r_magic = JOURNAL_RECORD_MAGIC;
+	record.r_sequence = journal_sequence;
+	record.r_block_num = block_num;
+	record.r_checksum = journal_checksum(block_num, data);
+	if (pwrite(journal_fd, &record, sizeof(record), journal_offset) != sizeof(record)
+		|| pwrite(journal_fd, data, EXT2_BLOCK_SIZE, journal_offset + sizeof(record)) != EXT2_BLOCK_SIZE
+		|| fdatasync(journal_fd) != 0) {
+		perror("journal");
+		exit(1);
+	}
+	journal_offset += sizeof(record) + EXT2_BLOCK_SIZE;
+	logged_blocks[block_num / 8] |= (1 << (block_num % 8));
+	logged_count += 1;
+}
+
+/*
+    Make everything logged so far permanent: sync the image, then retire the
+    log by advancing the sequence number.
+ */
+void journal_commit() {
+	if (journal_fd < 0) {
+		return;
+	}
+	ops_in_transaction = 0;
+	if (logged_count == 0) {
+		return;
+	}
+	sync_image();
+	journal_sequence += 1;
+	if (write_journal_header() != 0) {
+		perror("journal");
+		exit(1);
+	}
+	ftruncate(journal_fd, sizeof(struct journal_header));
+	memset(logged_blocks, 0, logged_blocks_size);
+	journal_offset = sizeof(struct journal_header);
+	logged_count = 0;
+}
+
+// Called once per completed operation; commits every ops_per_commit operations.
+void journal_end_operation() {
+	if (journal_fd < 0) {
+		return;
+	}
+	ops_in_transaction += 1;
+	if (ops_in_transaction >= ops_per_commit) {
+		journal_commit();
+	}
+}
+
+void journal_close() {
+	if (journal_fd < 0) {
+		return;
+	}
+	journal_commit();
+	close(journal_fd);
+	journal_fd = -1;
+	free(logged_blocks);
+	logged_blocks = NULL;
+}
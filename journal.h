@@ -0,0 +1,45 @@
+#ifndef EXT2_JOURNAL_H
+#define EXT2_JOURNAL_H
+
+/*
+ * Optional metadata journal kept in a sidecar file next to the image
+ * ("<image>.journal").  The image is modified in place through the shared
+ * mapping, so the journal is an undo log: before a metadata block is changed
+ * for the first time in a transaction its old contents are appended to the
+ * sidecar and synced.  A commit syncs the image and then bumps the sequence
+ * number in the journal header, which invalidates every logged block.
+ * Recovery writes back the blocks of an uncommitted transaction, leaving the
+ * image exactly as it was at the last commit.
+ *
+ * The journal is enabled with EXT2_JOURNAL=1.  EXT2_JOURNAL_BATCH=<n> groups
+ * n operations into a single commit for tools that perform many operations
+ * in one run.  A leftover sidecar is always recovered, even when the journal
+ * is not enabled for the current run. With an overlay (EXT2_OVERLAY) the
+ * journal belongs to the delta and is named "<delta>.journal".
+ */
+
+#define JOURNAL_MAGIC 0x4a325845 /* "EX2J" */
+#define JOURNAL_RECORD_MAGIC 0x52325845 /* "EX2R" */
+
+struct journal_header {
+	unsigned int j_magic;
+	unsigned int j_sequence;   /* Sequence of the transaction being logged */
+	unsigned int j_block_size;
+	unsigned int j_pad;
+};
+
+struct journal_record {
+	unsigned int r_magic;
+	unsigned int r_sequence;   /* Must match j_sequence to be replayed */
+	unsigned int r_block_num;  /* Image block the contents belong to */
+	unsigned int r_checksum;   /* Checksum of block number and contents */
+	/* followed by EXT2_BLOCK_SIZE bytes of the block's old contents */
+};
+
+int journal_open(char *image_path);
+void journal_log_block(int block_num);
+void journal_end_operation();
+void journal_commit();
+void journal_close();
+
+#endif
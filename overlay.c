@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "ext2.h"
+#include "overlay.h"
+
+static int delta_fd = -1;
+static int base_image_fd = -1;
+static struct overlay_header header;
+static unsigned char *present;      // block-presence bitmap
+static size_t present_size;
+static int present_changed;         // bitmap differs from the copy in the delta
+
+static int block_present(int block_num) {
+	return (present[block_num / 8] >> (block_num % 8)) & 1;
+}
+
+static off_t delta_offset(int block_num) {
+	return (off_t) header.o_data_offset + (off_t) block_num * EXT2_BLOCK_SIZE;
+}
+
+/*
+    Open the delta at delta_path on top of the base image open on base_fd,
+    creating an empty delta if it does not exist yet.
+    Returns 0 on success, -1 on failure.
+ */
+int overlay_open(char *delta_path, int base_fd, int blocks_count) {
+	base_image_fd = base_fd;
+	delta_fd = open(delta_path, O_RDWR | O_CREAT, 0644);
+	if (delta_fd < 0) {
+		return -1;
+	}
+	present_size = (blocks_count / 8 + EXT2_BLOCK_SIZE) / EXT2_BLOCK_SIZE * EXT2_BLOCK_SIZE;
+	present = calloc(present_size, 1);
+
+	if (pread(delta_fd, &header, sizeof(header), 0) == sizeof(header)) {
+		if (header.o_magic != OVERLAY_MAGIC || header.o_block_size != EXT2_BLOCK_SIZE
+			|| header.o_blocks_count != (unsigned int) blocks_count) {
+			fprintf(stderr, "%s is not a delta of this image\n", delta_path);
+			return -1;
+		}
+		if (pread(delta_fd, present, present_size, EXT2_BLOCK_SIZE) < 0) {
+			return -1;
+		}
+		return 0;
+	}
+	// a new, empty delta: creating a snapshot costs a header and a bitmap
+	memset(&header, 0, sizeof(header));
+	header.o_magic = OVERLAY_MAGIC;
+	header.o_block_size = EXT2_BLOCK_SIZE;
+	header.o_blocks_count = blocks_count;
+	header.o_data_offset = EXT2_BLOCK_SIZE + present_size;
+	present_changed = 1;
+	return overlay_sync(1);
+}
+
+// Read block_num from the delta if it was ever written, else from the base.
+void overlay_read_block(int block_num, unsigned char *data) {
+	ssize_t got;
+	if (block_present(block_num)) {
+		got = pread(delta_fd, data, EXT2_BLOCK_SIZE, delta_offset(block_num));
+	} else {
+		got = pread(base_image_fd, data, EXT2_BLOCK_SIZE, (off_t) block_num * EXT2_BLOCK_SIZE);
+	}
+	if (got < 0) {
+		perror("overlay");
+		exit(1);
+	}
+	if (got < EXT2_BLOCK_SIZE) {
+		memset(data + got, 0, EXT2_BLOCK_SIZE - got);
+	}
+}
+
+// Write count adjacent blocks starting at block_num into the delta.
+void overlay_write_blocks(int block_num, struct iovec *iov, int count) {
+	if (pwritev(delta_fd, iov, count, delta_offset(block_num)) != (ssize_t) count * EXT2_BLOCK_SIZE) {
+		perror("overlay");
+		exit(1);
+	}
+	int i;
+	for (i = block_num; i < block_num + count; i++) {
+		if (!block_present(i)) {
+			present[i / 8] |= (1 << (i % 8));
+			header.o_present_count += 1;
+			present_changed = 1;
+		}
+	}
+}
+
+/*
+    Persist the presence bitmap. The data is synced before the bitmap that
+    makes it visible is written, so that takes wait: without it the bitmap
+    stays pending until the next call with wait set, which overlay_close
+    always makes. With wait set the delta is synced.
+    Returns 0 on success, -1 on failure.
+ */
+int overlay_sync(int wait) {
+	if (delta_fd < 0 || !wait) {
+		return 0;
+	}
+	if (present_changed) {
+		if (fdatasync(delta_fd) != 0) {
+			return -1;
+		}
+		if (pwrite(delta_fd, &header, sizeof(header), 0) != sizeof(header)
+			|| pwrite(delta_fd, present, present_size, EXT2_BLOCK_SIZE) != (ssize_t) present_size) {
+			return -1;
+		}
+		present_changed = 0;
+	}
+	return fdatasync(delta_fd);
+}
+
+/*
+    Merge every block of the delta into the base image open on base_fd, one
+    write per run of adjacent blocks, then empty the delta.
+    Returns the number of blocks merged, or -1 on failure.
+ */
+int overlay_commit(int base_fd) {
+	unsigned char *run = malloc(64 * EXT2_BLOCK_SIZE);
+	int merged = 0;
+	int block_num = 0;
+	while (block_num < (int) header.o_blocks_count) {
+		if (!block_present(block_num)) {
+			block_num += 1;
+			continue;
+		}
+		int count = 0;
+		while (block_num + count < (int) header.o_blocks_count && block_present(block_num + count) && count < 64) {
+			count += 1;
+		}
+		ssize_t length = (ssize_t) count * EXT2_BLOCK_SIZE;
+		if (pread(delta_fd, run, length, delta_offset(block_num)) != length
+			|| pwrite(base_fd, run, length, (off_t) block_num * EXT2_BLOCK_SIZE) != length) {
+			free(run);
+			return -1;
+		}
+		merged += count;
+		block_num += count;
+	}
+	free(run);
+	if (fsync(base_fd) != 0) {
+		return -1;
+	}
+	// the base now holds everything: drop the data and start an empty delta
+	memset(present, 0, present_size);
+	header.o_present_count = 0;
+	present_changed = 1;
+	if (overlay_sync(1) != 0 || ftruncate(delta_fd, header.o_data_offset) != 0) {
+		return -1;
+	}
+	return merged;
+}
+
+void overlay_close() {
+	if (delta_fd < 0) {
+		return;
+	}
+	// the blocks written are only in the delta once the bitmap is
+	if (overlay_sync(1) != 0) {
+		perror("overlay");
+	}
+	close(delta_fd);
+	delta_fd = -1;
+	free(present);
+	present = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef EXT2_OVERLAY_H
+#define EXT2_OVERLAY_H
+
+#include <sys/uio.h>
+
+/*
+ * Copy-on-write overlay of a read-only base image. Every block written goes
+ * to a sparse delta file and is recorded in the delta's block-presence
+ * bitmap; reads of blocks that were never written fall through to the base.
+ *
+ * Delta layout: one header block, the presence bitmap padded to whole
+ * blocks, then block n of the image at data_offset + n * EXT2_BLOCK_SIZE.
+ * Only blocks that were written take space on the host.
+ */
+
+#define OVERLAY_MAGIC 0x4f325845 /* "EX2O" */
+
+struct overlay_header {
+	unsigned int o_magic;
+	unsigned int o_block_size;
+	unsigned int o_blocks_count;  /* Blocks in the base image */
+	unsigned int o_data_offset;   /* Byte offset of image block 0 in the delta */
+	unsigned int o_present_count; /* Blocks stored in the delta */
+};
+
+int overlay_open(char *delta_path, int base_fd, int blocks_count);
+void overlay_read_block(int block_num, unsigned char *data);
+void overlay_write_blocks(int block_num, struct iovec *iov, int count);
+int overlay_sync(int wait);
+int overlay_commit(int base_fd);
+void overlay_close();
+
+#endif
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "tar.h"
+
+/*
+    Read a numeric field, in octal or in GNU base-256.
+ */
+unsigned long long tar_get_number(const char *field, int length) {
+	unsigned long long value = 0;
+	int i;
+	if ((unsigned char) field[0] & 0x80) {
+		value = (unsigned char) field[0] & 0x7f;
+		for (i = 1; i < length; i++) {
+			value = (value << 8) | (unsigned char) field[i];
+		}
+		return value;
+	}
+	for (i = 0; i < length && field[i] == ' '; i++) {
+	}
+	for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+		value = value * 8 + (field[i] - '0');
+	}
+	return value;
+}
+
+/*
+    Write value into a numeric field: octal when it fits in length - 1
+    digits, base-256 otherwise.
+ */
+void tar_set_number(char *field, int length, unsigned long long value) {
+	if (length - 1 >= 22 || value < (1ULL << (3 * (length - 1)))) {
+		snprintf(field, length, "%0*llo", length - 1, value);
+		return;
+	}
+	int i;
+	for (i = length - 1; i > 0; i--) {
+		field[i] = value & 0xff;
+		value >>= 8;
+	}
+	field[0] = (char) 0x80;
+}
+
+static unsigned int header_checksum(struct tar_header *header) {
+	unsigned char *bytes = (unsigned char *) header;
+	unsigned int sum = 0;
+	int i;
+	for (i = 0; i < TAR_RECORD_SIZE; i++) {
+		// the checksum field itself counts as spaces
+		if (i >= (int) offsetof(struct tar_header, t_checksum)
+			&& i < (int) (offsetof(struct tar_header, t_checksum) + sizeof(header->t_checksum))) {
+			sum += ' ';
+		} else {
+			sum += bytes[i];
+		}
+	}
+	return sum;
+}
+
+// The end of an archive is marked by zero records.
+int tar_header_is_zero(struct tar_header *header) {
+	unsigned char *bytes = (unsigned char *) header;
+	int i;
+	for (i = 0; i < TAR_RECORD_SIZE; i++) {
+		if (bytes[i] != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int tar_header_valid(struct tar_header *header) {
+	return tar_get_number(header->t_checksum, sizeof(header->t_checksum)) == header_checksum(header);
+}
+
+/*
+    Store the entry's path, prefix and name joined, in name, which has room
+    for 256 bytes.
+ */
+void tar_header_name(struct tar_header *header, char *name) {
+	int length = 0;
+	if (memcmp(header->t_magic, "ustar", 5) == 0 && header->t_prefix[0] != '\0') {
+		length = strnlen(header->t_prefix, sizeof(header->t_prefix));
+		memcpy(name, header->t_prefix, length);
+		name[length++] = '/';
+	}
+	int name_length = strnlen(header->t_name, sizeof(header->t_name));
+	memcpy(name + length, header->t_name, name_length);
+	name[length + name_length] = '\0';
+}
+
+// Fill in the magic and the checksum once every other field is set.
+void tar_finish_header(struct tar_header *header) {
+	memcpy(header->t_magic, "ustar", 6);
+	memcpy(header->t_version, "00", 2);
+	snprintf(header->t_checksum, sizeof(header->t_checksum), "%06o", header_checksum(header));
+	header->t_checksum[7] = ' ';
+}
+
+// Bytes of padding after size bytes of data, up to a whole record.
+long long tar_padding(long long size) {
+	return (TAR_RECORD_SIZE - size % TAR_RECORD_SIZE) % TAR_RECORD_SIZE;
+}
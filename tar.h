@@ -0,0 +1,55 @@
+#ifndef EXT2_TAR_H
+#define EXT2_TAR_H
+
+/*
+ * POSIX ustar archive format, shared by ext2_tar_import and ext2_tar_export.
+ * An archive is a sequence of 512-byte records: a header per entry followed
+ * by the entry's data padded to whole records, and two zero records at the
+ * end. Numeric fields are NUL-terminated octal; larger values use the GNU
+ * base-256 form (high bit of the first byte set). Names that do not fit
+ * the 100-byte name field (and the 155-byte prefix) are carried by a GNU
+ * long-name entry ('L', or 'K' for a link target) just before the header,
+ * or by a pax extended header ('x').
+ */
+
+#define TAR_RECORD_SIZE 512
+
+#define TAR_REGULAR   '0'
+#define TAR_HARDLINK  '1'
+#define TAR_SYMLINK   '2'
+#define TAR_DIRECTORY '5'
+#define TAR_CONTIGUOUS '7'
+#define TAR_PAX_HEADER 'x'
+#define TAR_PAX_GLOBAL 'g'
+#define TAR_GNU_LONGNAME 'L'
+#define TAR_GNU_LONGLINK 'K'
+
+struct tar_header {
+	char t_name[100];
+	char t_mode[8];
+	char t_uid[8];
+	char t_gid[8];
+	char t_size[12];
+	char t_mtime[12];
+	char t_checksum[8];
+	char t_typeflag;
+	char t_linkname[100];
+	char t_magic[6];       /* "ustar" */
+	char t_version[2];     /* "00" */
+	char t_uname[32];
+	char t_gname[32];
+	char t_devmajor[8];
+	char t_devminor[8];
+	char t_prefix[155];    /* Leading directories of a long name */
+	char t_pad[12];
+};
+
+unsigned long long tar_get_number(const char *field, int length);
+void tar_set_number(char *field, int length, unsigned long long value);
+int tar_header_is_zero(struct tar_header *header);
+int tar_header_valid(struct tar_header *header);
+void tar_header_name(struct tar_header *header, char *name);
+void tar_finish_header(struct tar_header *header);
+long long tar_padding(long long size);
+
+#endif
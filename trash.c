@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ext2.h"
+#include "helper.h"
+#include "trash.h"
+
+static int record_len(int name_len) {
+	return (sizeof(struct trash_record) + name_len + 3) & ~3;
+}
+
+// The trash directory, created on demand with its empty log when create is
+// set; -1 if missing.
+static int trash_dir_num(int create) {
+	int dir_num = find_token_in_dir(EXT2_ROOT_INO, TRASH_DIR_NAME);
+	if (dir_num != -1 || !create) {
+		return dir_num;
+	}
+	if (!ensure_free_space(1 + inode_needs_new_block_for_new_dir_entry(EXT2_ROOT_INO, strlen(TRASH_DIR_NAME)), 2)) {
+		return -1;
+	}
+	dir_num = find_first_available_inode();
+	if (make_directory(EXT2_ROOT_INO, TRASH_DIR_NAME, dir_num) != 0) {
+		update_inode_bitmap(dir_num, 0);
+		return -1;
+	}
+	// a new directory always has room for its first entry
+	int log_num = find_first_available_inode();
+	make_inode(log_num, 'f');
+	get_inode_pointer(log_num)->i_size = 0;
+	make_dir_entry_in_inode(dir_num, TRASH_LOG_NAME, log_num, 'f');
+	return dir_num;
+}
+
+// The inode of the log, or NULL when there is no trash.
+static struct ext2_inode *log_inode(int *log_num) {
+	int dir_num = trash_dir_num(0);
+	if (dir_num == -1) {
+		return NULL;
+	}
+	*log_num = find_token_in_dir(dir_num, TRASH_LOG_NAME);
+	return *log_num == -1 ? NULL : get_inode_pointer(*log_num);
+}
+
+/*
+    Walk the live records of the log. cursor starts at 0 and is advanced past
+    the returned record; the log block holding it is stored in block_num.
+    Returns NULL after the last record.
+ */
+struct trash_record *next_trash_record(int *cursor, int *block_num) {
+	int log_num;
+	struct ext2_inode *log = log_inode(&log_num);
+	while (log != NULL && *cursor / EXT2_BLOCK_SIZE < 12) {
+		int i_block_idx = *cursor / EXT2_BLOCK_SIZE;
+		int offset = *cursor % EXT2_BLOCK_SIZE;
+		if (log->i_block[i_block_idx] == 0) {
+			return NULL;
+		}
+		struct trash_record *record = (struct trash_record *) (get_block(log->i_block[i_block_idx]) + offset);
+		if (offset + sizeof(struct trash_record) > EXT2_BLOCK_SIZE || record->t_rec_len == 0) {
+			*cursor = (i_block_idx + 1) * EXT2_BLOCK_SIZE;
+			continue;
+		}
+		*cursor += record->t_rec_len;
+		if (record->t_inode != 0) {
+			*block_num = log->i_block[i_block_idx];
+			return record;
+		}
+	}
+	return NULL;
+}
+
+// The index in the log's i_block of the first block with room for a record
+// of needed bytes, -1 if the log is full. The record goes at *offset; a
+// block not allocated yet has room at 0.
+static int find_log_space(struct ext2_inode *log, int needed, int *offset) {
+	int i;
+	for (i = 0; i < 12; i++) {
+		*offset = 0;
+		if (log->i_block[i] == 0) {
+			return i;
+		}
+		unsigned char *block = get_block(log->i_block[i]);
+		while (*offset + sizeof(struct trash_record) <= EXT2_BLOCK_SIZE
+			&& ((struct trash_record *) (block + *offset))->t_rec_len != 0) {
+			*offset += ((struct trash_record *) (block + *offset))->t_rec_len;
+		}
+		if (*offset + needed <= EXT2_BLOCK_SIZE) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Append a record to the log, growing it by a block when the last one is
+// full. Returns 0 on success, ENOSPC when the log or the image is full.
+static int append_record(int parent_num, int inode_num, int file_type, char *name) {
+	int log_num;
+	struct ext2_inode *log = log_inode(&log_num);
+	if (log == NULL) {
+		return ENOSPC;
+	}
+	int needed = record_len(strlen(name));
+	int offset;
+	int i = find_log_space(log, needed, &offset);
+	if (i == -1) {
+		return ENOSPC;
+	}
+	if (log->i_block[i] == 0) {
+		int block_num = find_first_available_block();
+		if (block_num == -1) {
+			return ENOSPC;
+		}
+		dirty_inode(log_num);
+		dirty_metadata_block(block_num);
+		memset(get_block(block_num), 0, EXT2_BLOCK_SIZE);
+		log->i_block[i] = block_num;
+		log->i_blocks += 2;
+		log->i_size = (i + 1) * EXT2_BLOCK_SIZE;
+	}
+	dirty_metadata_block(log->i_block[i]);
+	struct trash_record *record = (struct trash_record *) (get_block(log->i_block[i]) + offset);
+	record->t_inode = inode_num;
+	record->t_parent = parent_num;
+	record->t_dtime = (unsigned int) time(NULL);
+	record->t_rec_len = needed;
+	record->t_name_len = strlen(name);
+	record->t_file_type = file_type;
+	memcpy(record->t_name, name, record->t_name_len);
+	return 0;
+}
+
+// Blocks the trash needs to take the entry name of inode trash_name: one
+// for its directory unless the inode is already in it, one for the log.
+// -1 if the directory or the log is full.
+static int blocks_to_trash(int trash_num, char *trash_name, char *name) {
+	int log_num;
+	struct ext2_inode *log = log_inode(&log_num);
+	int offset;
+	int log_idx = log == NULL ? -1 : find_log_space(log, record_len(strlen(name)), &offset);
+	if (log_idx == -1) {
+		return -1;
+	}
+	int blocks = log->i_block[log_idx] == 0;
+	if (find_token_in_dir(trash_num, trash_name) == -1) {
+		if (first_available_i_block(trash_num, strlen(trash_name)) == -1) {
+			return -1;
+		}
+		blocks += inode_needs_new_block_for_new_dir_entry(trash_num, strlen(trash_name));
+	}
+	return blocks;
+}
+
+/*
+    Move the entry name of directory parent_num into the trash and log it.
+    The room for both is made first, purging the trash if it is full, so
+    that nothing is purged once the entry starts moving. Returns 0 on
+    success, ENOENT if there is no such entry, EINVAL for an entry of the
+    trash itself and ENOSPC if the trash cannot take it.
+ */
+int trash_entry(int parent_num, char *name) {
+	int inode_num = find_token_in_dir(parent_num, name);
+	if (inode_num == -1) {
+		return ENOENT;
+	}
+	int trash_num = trash_dir_num(1);
+	if (trash_num == -1) {
+		return ENOSPC;
+	}
+	// the trash and its log cannot be trashed themselves
+	if (parent_num == trash_num || inode_num == trash_num) {
+		return EINVAL;
+	}
+	char trash_name[16];
+	snprintf(trash_name, sizeof(trash_name), "%d", inode_num);
+	// make room by emptying the trash when its directory or log is full
+	int blocks_needed = blocks_to_trash(trash_num, trash_name, name);
+	if (blocks_needed == -1) {
+		trash_purge();
+		blocks_needed = blocks_to_trash(trash_num, trash_name, name);
+	}
+	if (blocks_needed == -1 || !ensure_free_space(blocks_needed, 0)) {
+		return ENOSPC;
+	}
+	struct ext2_inode *inode = get_inode_pointer(inode_num);
+	char type = find_filetype(inode->i_mode);
+	int file_type = type == 'd' ? EXT2_FT_DIR : type == 'l' ? EXT2_FT_SYMLINK : EXT2_FT_REG_FILE;
+
+	// the entry in the trash comes first: a record never names an inode the
+	// trash does not hold. Another name of the same inode may already be in it.
+	int added = 0;
+	if (find_token_in_dir(trash_num, trash_name) == -1) {
+		if (make_dir_entry_in_inode(trash_num, trash_name, inode_num, type == 'l' ? 's' : type) != 0) {
+			return ENOSPC;
+		}
+		added = 1;
+	}
+	if (append_record(parent_num, inode_num, file_type, name) != 0) {
+		if (added) {
+			remove_victim_at_inode(trash_num, trash_name);
+		}
+		return ENOSPC;
+	}
+	remove_victim_at_inode(parent_num, name);
+	if (type == 'd') {
+		reparent_directory(inode_num, parent_num, trash_num);
+	}
+	return 0;
+}
+
+// Put the entry of record back into its directory and drop the record.
+static int restore_record(struct trash_record *record, int record_block, int trash_num) {
+	int inode_num = record->t_inode;
+	int parent_num = record->t_parent;
+	char name[EXT2_NAME_LEN + 1];
+	memcpy(name, record->t_name, record->t_name_len);
+	name[record->t_name_len] = '\0';
+	if (find_token_in_dir(parent_num, name) != -1) {
+		return EEXIST;
+	}
+	// purging here would release the inode being restored
+	char type = record->t_file_type == EXT2_FT_DIR ? 'd' : record->t_file_type == EXT2_FT_SYMLINK ? 's' : 'f';
+	if (make_dir_entry_in_inode(parent_num, name, inode_num, type) != 0) {
+		return ENOSPC;
+	}
+	if (type == 'd') {
+		reparent_directory(inode_num, trash_num, parent_num);
+	}
+	dirty_metadata_block(record_block);
+	record->t_inode = 0;
+
+	// the inode leaves the trash with its last logged name
+	int cursor = 0;
+	int block_num;
+	struct trash_record *other;
+	while ((other = next_trash_record(&cursor, &block_num)) != NULL) {
+		if (other->t_inode == inode_num) {
+			return 0;
+		}
+	}
+	char trash_name[16];
+	snprintf(trash_name, sizeof(trash_name), "%d", inode_num);
+	remove_victim_at_inode(trash_num, trash_name);
+	return 0;
+}
+
+/*
+    Restore the most recently trashed entry called name of directory
+    parent_num. Returns 0 on success, ENOENT if the trash holds no such entry
+    and EEXIST if the name is in use again.
+ */
+int trash_restore(int parent_num, char *name) {
+	int trash_num = trash_dir_num(0);
+	if (trash_num == -1) {
+		return ENOENT;
+	}
+	struct trash_record *latest = NULL;
+	int latest_block = 0;
+	int cursor = 0;
+	int block_num;
+	struct trash_record *record;
+	while ((record = next_trash_record(&cursor, &block_num)) != NULL) {
+		if (record->t_parent == parent_num && record->t_name_len == strlen(name)
+			&& strncmp(record->t_name, name, record->t_name_len) == 0
+			&& (latest == NULL || record->t_dtime >= latest->t_dtime)) {
+			latest = record;
+			latest_block = block_num;
+		}
+	}
+	if (latest == NULL) {
+		return ENOENT;
+	}
+	return restore_record(latest, latest_block, trash_num);
+}
+
+/*
+    Restore every trashed entry of directory parent_num.
+    Returns the number of entries restored.
+ */
+int trash_restore_all(int parent_num) {
+	int trash_num = trash_dir_num(0);
+	if (trash_num == -1) {
+		return 0;
+	}
+	int restored = 0;
+	int cursor = 0;
+	int block_num;
+	struct trash_record *record;
+	while ((record = next_trash_record(&cursor, &block_num)) != NULL) {
+		if (record->t_parent == parent_num && restore_record(record, block_num, trash_num) == 0) {
+			restored += 1;
+		}
+	}
+	return restored;
+}
+
+/*
+    Free everything in the trash in one batch: the entries are unlinked from
+    the trash directory, the inodes and blocks left without links are
+    released together with a single bitmap and counter update, and the log
+    is emptied. Returns the number of log records purged.
+ */
+int trash_purge() {
+	int trash_num = trash_dir_num(0);
+	if (trash_num == -1) {
+		return 0;
+	}
+	struct release_list inodes = {NULL, 0, 0};
+	struct release_list blocks = {NULL, 0, 0};
+	int dirs = 0;
+	int purged = 0;
+
+	int cursor = 0;
+	int block_num;
+	struct trash_record *record;
+	while ((record = next_trash_record(&cursor, &block_num)) != NULL) {
+		purged += 1;
+		char trash_name[16];
+		snprintf(trash_name, sizeof(trash_name), "%d", record->t_inode);
+		if (find_token_in_dir(trash_num, trash_name) == -1) {
+			continue;  // released with an earlier record of the same inode
+		}
+		int inode_num = remove_victim_at_inode(trash_num, trash_name);
+		struct ext2_inode *inode = get_inode_pointer(inode_num);
+		if (find_filetype(inode->i_mode) == 'd') {
+			dirty_inode(trash_num);
+			get_inode_pointer(trash_num)->i_links_count--;
+			dirs += release_tree(inode_num, &inodes, &blocks);
+		} else if (inode->i_links_count == 0) {
+			release_inode(inode_num, &inodes, &blocks);
+		}
+	}
+
+	// empty the log, keeping its blocks for the next records
+	int log_num;
+	struct ext2_inode *log = log_inode(&log_num);
+	int i;
+	for (i = 0; log != NULL && i < 12 && log->i_block[i] != 0; i++) {
+		dirty_metadata_block(log->i_block[i]);
+		memset(get_block(log->i_block[i]), 0, EXT2_BLOCK_SIZE);
+	}
+	free_released_lists(&inodes, &blocks, dirs);
+	free(inodes.nums);
+	free(blocks.nums);
+	return purged;
+}
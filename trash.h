@@ -0,0 +1,39 @@
+#ifndef EXT2_TRASH_H
+#define EXT2_TRASH_H
+
+/*
+ * Trash for undoable removal (ext2_rm -u). A trashed entry is moved out of
+ * its directory into the hidden directory "/.trash", named by its inode
+ * number, so its inode and blocks stay allocated and untouched; the original
+ * parent, name and time are appended to a compact log kept in the regular
+ * file "/.trash/.log" (TRASH_LOG_NAME). Restoring is a lookup in the log that
+ * cannot fail for lack of the data. Purging frees everything in the trash in
+ * one batch and empties the log; it happens on request (ext2_trash -p) and
+ * automatically when a command finds the image or the trash full before it
+ * starts changing anything.
+ *
+ * The log is a sequence of records packed like directory entries; a record
+ * with t_rec_len 0 ends the records of a block, and a record whose entry
+ * was restored keeps its place with t_inode 0 until the next purge.
+ */
+
+#define TRASH_DIR_NAME ".trash"
+#define TRASH_LOG_NAME ".log"
+
+struct trash_record {
+	unsigned int t_inode;      /* Trashed inode, 0 once restored */
+	unsigned int t_parent;     /* Directory the entry was removed from */
+	unsigned int t_dtime;      /* When it was trashed */
+	unsigned short t_rec_len;  /* Length of this record */
+	unsigned char t_name_len;
+	unsigned char t_file_type;
+	char t_name[];             /* Original name, not NUL-terminated */
+};
+
+int trash_entry(int parent_num, char *name);
+int trash_restore(int parent_num, char *name);
+int trash_restore_all(int parent_num);
+struct trash_record *next_trash_record(int *cursor, int *block_num);
+int trash_purge();
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+static int ring_fd = -1;
+static unsigned int *sq_head;
+static unsigned int *sq_tail;
+static unsigned int *sq_mask;
+static unsigned int *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned int *cq_head;
+static unsigned int *cq_tail;
+static unsigned int *cq_mask;
+static struct io_uring_cqe *cqes;
+static void *sq_ring;
+static void *cq_ring;
+static size_t sq_ring_size;
+static size_t cq_ring_size;
+static size_t sqes_size;
+static unsigned int sq_entries;
+static unsigned int queued;     // filled in but not yet submitted
+static unsigned int in_flight;  // submitted but not yet reaped
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_register(unsigned int opcode, void *arg, unsigned int nr_args) {
+	return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/*
+    Check that the kernel supports the opcodes the backend queues. Kernels
+    before 5.6 have io_uring but neither IORING_OP_READ nor the probe, so
+    a failing probe counts as missing opcodes.
+ */
+static int opcodes_supported() {
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	int supported = 0;
+	if (io_uring_register(IORING_REGISTER_PROBE, probe, 256) == 0) {
+		supported = probe->ops_len > IORING_OP_READ && probe->ops_len > IORING_OP_WRITEV
+			&& (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+			&& (probe->ops[IORING_OP_WRITEV].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	return supported;
+}
+
+static int io_uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+	return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/*
+    Set up a ring with room for the given number of requests.
+    Returns 0 on success, -1 if io_uring or the opcodes used here are not
+    available.
+ */
+int uring_init(unsigned int entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring_fd = io_uring_setup(entries, &params);
+	if (ring_fd < 0) {
+		return -1;
+	}
+	if (!opcodes_supported()) {
+		close(ring_fd);
+		ring_fd = -1;
+		return -1;
+	}
+	sq_entries = params.sq_entries;
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_ring_size > sq_ring_size) {
+			sq_ring_size = cq_ring_size;
+		}
+		cq_ring_size = sq_ring_size;
+	}
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		close(ring_fd);
+		ring_fd = -1;
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			munmap(sq_ring, sq_ring_size);
+			close(ring_fd);
+			ring_fd = -1;
+			return -1;
+		}
+	}
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		uring_close();
+		return -1;
+	}
+
+	sq_head = (unsigned int *)((char *) sq_ring + params.sq_off.head);
+	sq_tail = (unsigned int *)((char *) sq_ring + params.sq_off.tail);
+	sq_mask = (unsigned int *)((char *) sq_ring + params.sq_off.ring_mask);
+	sq_array = (unsigned int *)((char *) sq_ring + params.sq_off.array);
+	cq_head = (unsigned int *)((char *) cq_ring + params.cq_off.head);
+	cq_tail = (unsigned int *)((char *) cq_ring + params.cq_off.tail);
+	cq_mask = (unsigned int *)((char *) cq_ring + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((char *) cq_ring + params.cq_off.cqes);
+	queued = 0;
+	in_flight = 0;
+	return 0;
+}
+
+void uring_close() {
+	if (ring_fd < 0) {
+		return;
+	}
+	if (sqes != NULL && sqes != MAP_FAILED) {
+		munmap(sqes, sqes_size);
+	}
+	if (cq_ring != sq_ring) {
+		munmap(cq_ring, cq_ring_size);
+	}
+	munmap(sq_ring, sq_ring_size);
+	close(ring_fd);
+	ring_fd = -1;
+	sqes = NULL;
+}
+
+int uring_available() {
+	return ring_fd >= 0;
+}
+
+// Return the next free submission entry, submitting queued ones if the ring is full.
+// Callers keep the number of requests in flight below the ring size.
+static struct io_uring_sqe *next_sqe() {
+	unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *sq_tail;
+	if (tail - head >= sq_entries) {
+		// the kernel consumes submission entries as soon as they are submitted
+		uring_submit();
+		head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	}
+	unsigned int idx = tail & *sq_mask;
+	struct io_uring_sqe *sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[idx] = idx;
+	return sqe;
+}
+
+static void push_sqe() {
+	__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+	queued += 1;
+}
+
+void uring_queue_read(int fd, void *buffer, size_t length, off_t offset, void *tag) {
+	struct io_uring_sqe *sqe = next_sqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) buffer;
+	sqe->len = length;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long) tag;
+	push_sqe();
+}
+
+// iov must stay valid until the request completes
+void uring_queue_writev(int fd, struct iovec *iov, int iov_count, off_t offset, void *tag) {
+	struct io_uring_sqe *sqe = next_sqe();
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) iov;
+	sqe->len = iov_count;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long) tag;
+	push_sqe();
+}
+
+/*
+    Hand every queued request to the kernel with a single system call.
+    Returns the number submitted.
+ */
+int uring_submit() {
+	int submitted = 0;
+	while (queued > 0) {
+		int ret = io_uring_enter(queued, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				continue;
+			}
+			perror("io_uring_enter");
+			exit(1);
+		}
+		queued -= ret;
+		in_flight += ret;
+		submitted += ret;
+	}
+	return submitted;
+}
+
+/*
+    Wait for one request to complete. Stores its result (bytes transferred or
+    -errno) and returns its tag. Returns NULL if nothing is in flight.
+ */
+void *uring_wait(int *result) {
+	if (queued > 0) {
+		uring_submit();
+	}
+	if (in_flight == 0) {
+		return NULL;
+	}
+	unsigned int head = *cq_head;
+	while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		if (io_uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+	}
+	struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+	void *tag = (void *)(unsigned long) cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+	in_flight -= 1;
+	return tag;
+}
+
+int uring_in_flight() {
+	return in_flight + queued;
+}
@@ -0,0 +1,23 @@
+#ifndef EXT2_URING_H
+#define EXT2_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Minimal io_uring wrapper (raw system calls, no liburing) used by the
+ * uring block backend. Requests carry an opaque tag that is handed back
+ * when they complete.
+ */
+
+int uring_init(unsigned int entries);
+void uring_close();
+int uring_available();
+void uring_queue_read(int fd, void *buffer, size_t length, off_t offset, void *tag);
+void uring_queue_writev(int fd, struct iovec *iov, int iov_count, off_t offset, void *tag);
+int uring_submit();
+void *uring_wait(int *result);
+int uring_in_flight();
+
+#endif